@@ -0,0 +1,1163 @@
+// Benchmarks of the MatrixDisplay rendering pipeline, drawn on a headless
+// ncurses screen whose output is counted and discarded.
+//
+// Besides the time, every benchmark reports per frame:
+//   time_per_cell: time spent per cell drawn
+//   bytes: bytes sent to the terminal, when the frame is flushed
+//   allocations: calls to operator new, which should be 0 once warmed up
+
+#include "matrix_display.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <clocale>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+std::atomic<long> allocations{0};
+}  // namespace
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto memory = std::malloc(size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+namespace {
+using namespace ncurses;
+
+// An ncurses screen writing to an in-memory file. ncurses writes straight to
+// the file descriptor, so the bytes it sends are counted from the offset of
+// the file, which is rewound after each count.
+class HeadlessScreen {
+   public:
+    HeadlessScreen() {
+        output = fdopen(memfd_create("cursed_bench", 0), "w");
+        input = std::fopen("/dev/null", "r");
+        screen = newterm("xterm-256color", output, input);
+        if (screen == nullptr) {
+            std::fputs("cursed_bench: cannot open a headless terminal\n",
+                       stderr);
+            std::exit(EXIT_FAILURE);
+        }
+        start_color();
+        for (int pair = 1; pair < 8; ++pair) {
+            init_pair(pair, COLOR_BLACK, pair);
+        }
+    }
+    ~HeadlessScreen() {
+        endwin();
+        delscreen(screen);
+        std::fclose(output);
+        std::fclose(input);
+    }
+    // Makes the headless screen the current one again.
+    void select() { set_term(screen); }
+    // Bytes sent to the terminal since the previous call.
+    long bytes_emitted() {
+        const auto descriptor = fileno(output);
+        const auto bytes = lseek(descriptor, 0, SEEK_CUR);
+        lseek(descriptor, 0, SEEK_SET);
+        return bytes;
+    }
+
+   private:
+    FILE* output;
+    FILE* input;
+    SCREEN* screen;
+};
+HeadlessScreen* headless = nullptr;
+
+// Limits of the headless screen, which keep the three screens ncurses
+// maintains small. Larger matrices are clipped, as on a real terminal.
+constexpr int max_lines = 512;
+constexpr int max_cols = 1024;
+
+// Resizes the screen to fit a rows by cols matrix and returns the number of
+// cells that are drawn.
+long fit_screen(const MatrixStyle& style, int rows, int cols) {
+    const auto lines = std::min(rows * (style.cell_height + 1) + 1, max_lines);
+    const auto width = std::min(cols * (style.cell_width + 1) + 1, max_cols);
+    resize_term(lines, width);
+    erase();
+    const auto line_stride = style.cell_height + 1;
+    const auto col_stride = style.cell_width + 1;
+    const auto visible_rows =
+        std::min(rows, (lines - 1 + style.cell_height) / line_stride);
+    const auto visible_cols =
+        std::min(cols, (width - 1 + style.cell_width) / col_stride);
+    return static_cast<long>(visible_rows) * visible_cols;
+}
+
+std::wstring value(int r, int c, int frame) {
+    return std::to_wstring((r * 31 + c * 17 + frame) % 1000);
+}
+int color(int r, int c, int frame) { return 1 + (r + c + frame) % 7; }
+
+CellGrid make_grid(int rows, int cols, int frame) {
+    CellGrid grid(rows, cols, 4);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            grid.set(r, c, value(r, c, frame), color(r, c, frame));
+        }
+    }
+    return grid;
+}
+
+std::vector<std::vector<Cell>> make_nested(int rows, int cols, int frame) {
+    std::vector<std::vector<Cell>> data(rows);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            data[r].emplace_back(value(r, c, frame), color(r, c, frame));
+        }
+    }
+    return data;
+}
+
+// Measures the frames drawn by the loop of state. draw(frame) renders one
+// frame, and flush tells whether it is sent to the terminal.
+void measure(benchmark::State& state, long cells, bool flush, auto draw) {
+    draw(0);
+    draw(1);
+    doupdate();
+    headless->bytes_emitted();
+    long frame_allocations = 0;
+    long bytes = 0;
+    int frame = 0;
+    for (auto _ : state) {
+        const auto allocations_before = allocations.load();
+        move(0, 0);
+        draw(frame++ & 1);
+        if (flush) {
+            wnoutrefresh(stdscr);
+            doupdate();
+        }
+        frame_allocations += allocations.load() - allocations_before;
+        bytes += headless->bytes_emitted();
+    }
+    using benchmark::Counter;
+    state.counters["time_per_cell"] =
+        Counter(cells, Counter::kIsIterationInvariantRate | Counter::kInvert);
+    state.counters["allocations"] =
+        Counter(frame_allocations, Counter::kAvgIterations);
+    state.counters["bytes"] = Counter(bytes, Counter::kAvgIterations);
+}
+
+MatrixStyle style_of(const benchmark::State& state) {
+    return MatrixStyle(state.range(1), state.range(2));
+}
+
+void grid_sizes(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgNames({"n", "cell_width", "cell_height"})
+        ->ArgsProduct({{8, 64, 256, 1024}, {3, 6}, {1, 3}});
+}
+
+void BM_Print(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto cells = fit_screen(style, n, n);
+    const CellGrid frames[] = {make_grid(n, n, 0), make_grid(n, n, 1)};
+    MatrixDisplay display(style);
+    measure(state, cells, false,
+            [&](int frame) { display.print(frames[frame]); });
+}
+BENCHMARK(BM_Print)->Apply(grid_sizes);
+
+void BM_PrintNested(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto cells = fit_screen(style, n, n);
+    const std::vector<std::vector<Cell>> frames[] = {make_nested(n, n, 0),
+                                                     make_nested(n, n, 1)};
+    MatrixDisplay display(style);
+    measure(state, cells, false,
+            [&](int frame) { display.print(frames[frame]); });
+}
+BENCHMARK(BM_PrintNested)->Apply(grid_sizes);
+
+// Full frames whose rows are formatted by a number of threads.
+void BM_PrintParallel(benchmark::State& state) {
+    const int n = state.range(0);
+    const MatrixStyle style(6, 3);
+    const auto cells = static_cast<long>(n) * n;
+    const CellGrid frames[] = {make_grid(n, n, 0), make_grid(n, n, 1)};
+    MemoryBackend memory(n * 4 + 1, n * 7 + 1);
+    MatrixDisplay display(style, Redraw::full, state.range(1));
+    measure(state, cells, false,
+            [&](int frame) { display.print(memory, 0, 0, frames[frame]); });
+}
+BENCHMARK(BM_PrintParallel)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{64, 512}, {1, 2, 4, 8}})
+    ->UseRealTime();
+
+// Full frames drawn in a framebuffer in memory instead of on the screen.
+void BM_PrintMemory(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto cells = fit_screen(style, n, n);
+    const CellGrid frames[] = {make_grid(n, n, 0), make_grid(n, n, 1)};
+    MemoryBackend memory(LINES, COLS);
+    MatrixDisplay display(style);
+    measure(state, cells, false,
+            [&](int frame) { display.print(memory, 0, 0, frames[frame]); });
+}
+BENCHMARK(BM_PrintMemory)->Apply(grid_sizes);
+
+// Incremental frames in which one cell in a hundred changes.
+void BM_PrintIncremental(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto cells = fit_screen(style, n, n);
+    CellGrid frames[] = {make_grid(n, n, 0), make_grid(n, n, 0)};
+    for (int i = 0; i < n * n; i += 100) {
+        frames[1].set(i / n, i % n, L"*", 1);
+    }
+    MatrixDisplay display(style, Redraw::incremental);
+    measure(state, cells, false,
+            [&](int frame) { display.print(frames[frame]); });
+}
+BENCHMARK(BM_PrintIncremental)->Apply(grid_sizes);
+
+// Rewrites one cell of a drawn matrix, which costs the same whatever the
+// size of the matrix.
+void BM_UpdateCell(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    fit_screen(style, n, n);
+    const auto grid = make_grid(n, n, 0);
+    MatrixDisplay display(style);
+    display.print(grid);
+    measure(state, 1, false, [&](int frame) {
+        display.update_cell(frame, frame, value(0, 0, frame), 1 + frame);
+    });
+}
+BENCHMARK(BM_UpdateCell)->Apply(grid_sizes);
+
+// Appends a row of n cells below a table that fills the screen, which then
+// scrolls: the cost depends on n alone.
+void BM_Append(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    fit_screen(style, 64, n);
+    // Rows that repeat would let ncurses find shifts other than the scroll.
+    const int rows = 1000;
+    const auto grid = make_grid(rows, n, 0);
+    MatrixDisplay display(style);
+    int row = 0;
+    measure(state, n, true, [&](int) {
+        display.append(stdscr, n, grid, row++ % rows);
+    });
+}
+BENCHMARK(BM_Append)->Apply(grid_sizes);
+
+// Alternates between two terminal widths while an n by n matrix is shown:
+// incremental displays only draw the columns and borders that the resize
+// revealed or moved, full ones draw everything again.
+void BM_Resize(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto redraw = static_cast<Redraw>(state.range(1));
+    const MatrixStyle style(3, 1);
+    const auto cells = fit_screen(style, n, n);
+    const int lines = LINES;
+    const int widths[] = {COLS, std::max(COLS - 8 * (style.cell_width + 1), 1)};
+    const auto grid = make_grid(n, n, 0);
+    MatrixDisplay display(style, redraw);
+    measure(state, cells, false, [&](int frame) {
+        resize_term(lines, widths[frame]);
+        display.print(grid);
+    });
+}
+BENCHMARK(BM_Resize)
+    ->ArgNames({"n", "incremental"})
+    ->ArgsProduct({{64, 256}, {0, 1}});
+
+const std::wstring_view statuses[] = {L"OK", L"WARN", L"--", L"FAIL"};
+
+// Builds a frame of statuses, as text copied into a CellGrid or as labels.
+void BM_BuildGrid(benchmark::State& state) {
+    const int n = state.range(0);
+    CellGrid grid(n, n, 4);
+    measure(state, static_cast<long>(n) * n, false, [&](int frame) {
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                grid.set(r, c, statuses[(r + c + frame) & 3], frame);
+            }
+        }
+    });
+}
+BENCHMARK(BM_BuildGrid)->ArgName("n")->Arg(64)->Arg(256)->Arg(1024);
+
+void BM_BuildLabels(benchmark::State& state) {
+    const int n = state.range(0);
+    LabelPool pool;
+    const Label* labels[4];
+    for (int i = 0; i < 4; ++i) {
+        labels[i] = &pool.intern(statuses[i]);
+    }
+    LabelGrid grid(n, n);
+    measure(state, static_cast<long>(n) * n, false, [&](int frame) {
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                grid.set(r, c, *labels[(r + c + frame) & 3], frame);
+            }
+        }
+    });
+}
+BENCHMARK(BM_BuildLabels)->ArgName("n")->Arg(64)->Arg(256)->Arg(1024);
+
+// Incremental frames of labels that don't change, which diffing skips by
+// comparing label ids.
+void BM_PrintLabelsIncremental(benchmark::State& state) {
+    const int n = state.range(0);
+    const MatrixStyle style(6, 1);
+    const auto cells = static_cast<long>(n) * n;
+    LabelPool pool;
+    LabelGrid grid(n, n);
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            grid.set(r, c, pool.intern(statuses[(r + c) & 3]), 1);
+        }
+    }
+    MemoryBackend memory(n * 2 + 1, n * 7 + 1);
+    MatrixDisplay display(style, Redraw::incremental);
+    measure(state, cells, false,
+            [&](int) { display.print(memory, 0, 0, n, n, grid); });
+}
+BENCHMARK(BM_PrintLabelsIncremental)->ArgName("n")->Arg(64)->Arg(256);
+
+// Diffs and serializes frames in which one cell in a hundred changes, and
+// reports the size of the deltas.
+void BM_Delta(benchmark::State& state) {
+    const int n = state.range(0);
+    CellGrid frames[] = {make_grid(n, n, 0), make_grid(n, n, 0)};
+    for (int i = 0; i < n * n; i += 100) {
+        frames[1].set(i / n, i % n, L"*", 1);
+    }
+    FrameDelta delta;
+    std::size_t bytes = 0;
+    for (auto _ : state) {
+        diff(frames[0], frames[1], delta);
+        bytes = delta.serialize().size();
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.counters["delta_bytes"] = bytes;
+    state.counters["time_per_cell"] = benchmark::Counter(
+        static_cast<double>(n) * n,
+        benchmark::Counter::kIsIterationInvariantRate |
+            benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_Delta)->ArgName("n")->Arg(64)->Arg(256)->Arg(1024);
+
+// Turns a matrix of metrics into cells: with std::to_wstring and a color
+// per threshold, as callers used to, and with format_numbers.
+const NumericFormat metrics_format{2, {10, 50, 90}, {1, 2, 3, 4}};
+
+std::vector<double> make_metrics(int n) {
+    std::vector<double> values(static_cast<std::size_t>(n) * n);
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        values[i] = (i * 7919 % 10000) / 100.0;
+    }
+    return values;
+}
+
+void BM_FormatToWstring(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto values = make_metrics(n);
+    std::vector<std::vector<Cell>> data(n);
+    measure(state, static_cast<long>(n) * n, false, [&](int) {
+        for (int r = 0; r < n; ++r) {
+            data[r].clear();
+            for (int c = 0; c < n; ++c) {
+                const auto value = values[r * n + c];
+                int color = 0;
+                while (color < 3 && value >= metrics_format.thresholds[color]) {
+                    ++color;
+                }
+                data[r].emplace_back(std::to_wstring(value),
+                                     metrics_format.color_codes[color]);
+            }
+        }
+    });
+}
+BENCHMARK(BM_FormatToWstring)->ArgName("n")->Arg(64)->Arg(256);
+
+void BM_FormatNumbers(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto values = make_metrics(n);
+    CellGrid grid;
+    measure(state, static_cast<long>(n) * n, false, [&](int) {
+        format_numbers(std::span<const double>(values), n, n, metrics_format,
+                       grid);
+    });
+}
+BENCHMARK(BM_FormatNumbers)->ArgName("n")->Arg(64)->Arg(256);
+
+// Full frames sent to the terminal, alternating between two contents.
+void BM_Frame(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto cells = fit_screen(style, n, n);
+    const CellGrid frames[] = {make_grid(n, n, 0), make_grid(n, n, 1)};
+    MatrixDisplay display(style);
+    measure(state, cells, true,
+            [&](int frame) { display.print(frames[frame]); });
+}
+BENCHMARK(BM_Frame)->Apply(grid_sizes);
+
+// Builds and writes the separator lines, for a column count that changes
+// every frame so that the cache is rebuilt.
+void BM_SeparatorLines(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    fit_screen(style, 1, n + 1);
+    LineCache lines;
+    measure(state, n, false, [&](int frame) {
+        lines.update(n + frame, style);
+        mvwadd_wchnstr(stdscr, 0, 0, lines.top.data(), lines.top.size());
+        mvwadd_wchnstr(stdscr, 1, 0, lines.middle.data(), lines.middle.size());
+        mvwadd_wchnstr(stdscr, 2, 0, lines.bottom.data(), lines.bottom.size());
+    });
+}
+BENCHMARK(BM_SeparatorLines)
+    ->ArgNames({"n", "cell_width", "cell_height"})
+    ->ArgsProduct({{8, 64, 256}, {3, 6}, {1}});
+
+// Hands a frame from the producer to the renderer: what the producer pays
+// per frame on top of filling the grid, instead of holding a mutex for the
+// whole of print.
+void BM_FrameBufferHandoff(benchmark::State& state) {
+    FrameBuffer frames(64, 64);
+    for (auto _ : state) {
+        frames.publish();
+        benchmark::DoNotOptimize(frames.acquire());
+    }
+}
+BENCHMARK(BM_FrameBufferHandoff);
+
+const std::wstring contents[] = {L"", L"7", L"42.5", L"a longer label"};
+
+void BM_Centered(benchmark::State& state) {
+    const auto& content = contents[state.range(0)];
+    const int width = state.range(1);
+    std::vector<wchar_t> line(std::max<int>(width, content.length()));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(centered(content, width, line.begin()));
+    }
+}
+BENCHMARK(BM_Centered)
+    ->ArgNames({"content", "width"})
+    ->ArgsProduct({{0, 1, 2, 3}, {6, 32}});
+
+void BM_CenteredString(benchmark::State& state) {
+    const auto& content = contents[state.range(0)];
+    const int width = state.range(1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(centered(content, width));
+    }
+}
+BENCHMARK(BM_CenteredString)
+    ->ArgNames({"content", "width"})
+    ->ArgsProduct({{0, 1, 2, 3}, {6, 32}});
+
+void BM_Positioned(benchmark::State& state) {
+    const auto& content = contents[state.range(0)];
+    const int width = state.range(1);
+    std::vector<wchar_t> line(std::max<int>(width, content.length()));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(positioned(content, width, 1, line.begin()));
+    }
+}
+BENCHMARK(BM_Positioned)
+    ->ArgNames({"content", "width"})
+    ->ArgsProduct({{0, 1, 2, 3}, {6, 32}});
+
+void BM_ColorScheme(benchmark::State& state) {
+    const std::vector<int> scheme(state.range(0), COLOR_BLUE);
+    for (auto _ : state) {
+        ColorScheme colors(scheme);
+        benchmark::DoNotOptimize(colors);
+    }
+}
+BENCHMARK(BM_ColorScheme)->Arg(8)->Arg(64)->Arg(256);
+
+// Looks up the pairs of a gradient, which are only defined the first time.
+// The cache is private so that the pairs of the other benchmarks survive.
+void BM_PairCache(benchmark::State& state) {
+    const int n = state.range(0);
+    PairCache pairs(8, n);
+    int color = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(pairs.pair(COLOR_BLACK, color++ % n));
+    }
+}
+BENCHMARK(BM_PairCache)->Arg(8)->Arg(64)->Arg(256);
+
+// Checks rather than measurements. Each of them draws frames through one of
+// the paths of MatrixDisplay and fails when the framebuffer differs from the
+// one ReferencePrint, a transcription of the first print, draws, or when a
+// frame goes over its budget of allocations, bytes or calls. The path is
+// then timed. main fails when a check did, so that they can gate changes:
+// ctest runs them in cursed_checks, this file built with
+// CURSED_ENABLE_STATS, which the budgets of calls need.
+int failed_checks = 0;
+
+void fail(benchmark::State& state, const std::string& message) {
+    ++failed_checks;
+    state.SkipWithError(message.c_str());
+}
+
+// Contents that take the paths the numbers of make_grid don't: wide glyphs,
+// contents cut to the cell, empty cells, combining accents.
+const std::wstring_view samples[] = {L"日本", L"😀x", L"a longer label", L"",
+                                     L"e\u0301", L"7"};
+
+CellGrid reference_grid(int rows, int cols, int frame) {
+    auto grid = make_grid(rows, cols, 0);
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            const auto i = r * 7 + c * 3 + frame;
+            if (i % 5 == 0) {
+                grid.set(r, c, samples[i % 6], i % 8);
+            }
+        }
+    }
+    return grid;
+}
+
+// The print of the first MatrixDisplay, transcribed one character at a time
+// into a MemoryBackend, which the checks compare every other path with. It
+// only follows the rules print gained since: contents are centered on their
+// display width and cut to the cell, and the characters that take no column
+// are combined with the glyph before them.
+class ReferencePrint {
+   public:
+    ReferencePrint(MemoryBackend& memory_, const MatrixStyle& style_)
+        : memory(memory_), style(style_) {}
+    // Draws the first rows by cols cells of grid from line y, which can be
+    // above the framebuffer, and column 0.
+    void print(int y_, const CellGrid& grid, int rows, int cols) {
+        y = y_;
+        top_row(cols);
+        for (int r = 0; r < rows; ++r) {
+            if (r != 0) {
+                middle_row(cols);
+            }
+            std::vector<Cell> row;
+            for (int c = 0; c < cols; ++c) {
+                row.emplace_back(std::wstring(grid(r, c).content),
+                                 grid(r, c).color_code);
+            }
+            values(row);
+        }
+        bottom_row(cols);
+    }
+
+   private:
+    // A glyph and the characters combined with it.
+    struct Glyph {
+        std::wstring characters;
+        int width;
+    };
+    static std::vector<Glyph> glyphs(const std::wstring& content) {
+        std::vector<Glyph> glyphs;
+        for (const auto character : content) {
+            const auto printable = character >= 0x20 && character < 0x7f;
+            const auto width = printable ? 1 : wcwidth(character);
+            if (width > 0) {
+                glyphs.push_back({std::wstring(1, character), width});
+            } else if (width == 0 && !glyphs.empty() &&
+                       glyphs.back().characters.length() < CCHARW_MAX) {
+                glyphs.back().characters.push_back(character);
+            }
+        }
+        return glyphs;
+    }
+    void add(const std::wstring& characters, int width, attr_t attributes,
+             short pair) {
+        cchar_t character;
+        setcchar(&character, characters.c_str(), attributes, pair, nullptr);
+        memory.put(y, x, &character, 1);
+        x += width;
+    }
+    void addwch(wchar_t character) {
+        add(std::wstring(1, character), 1, A_NORMAL, 0);
+    }
+    void end_line() {
+        ++y;
+        x = 0;
+    }
+    // A cell of the color of color_code, as Color used to set it.
+    void printline(const Cell& cell) {
+        auto cut = glyphs(cell.content);
+        int width = 0;
+        std::size_t length = 0;
+        for (; length < cut.size(); ++length) {
+            if (width + cut[length].width > style.cell_width) {
+                break;
+            }
+            width += cut[length].width;
+        }
+        cut.resize(length);
+        const auto offset = (style.cell_width - width) / 2;
+        const auto pair = static_cast<short>(cell.color_code);
+        for (int i = 0; i < offset; ++i) {
+            add(L" ", 1, A_BOLD, pair);
+        }
+        for (const auto& glyph : cut) {
+            add(glyph.characters, glyph.width, A_BOLD, pair);
+        }
+        for (int i = offset + width; i < style.cell_width; ++i) {
+            add(L" ", 1, A_BOLD, pair);
+        }
+    }
+    void value_row(const std::vector<Cell>& row, wchar_t left,
+                   wchar_t intersection, wchar_t right) {
+        addwch(left);
+        auto first = true;
+        for (const auto& cell : row) {
+            if (first) {
+                first = false;
+            } else {
+                addwch(intersection);
+            }
+            printline(cell);
+        }
+        addwch(right);
+        end_line();
+    }
+    // The value_row of cells of plain glyphs, whose glyphs are written as
+    // they are rather than as contents.
+    void sep_row(int n, wchar_t left, wchar_t plain, wchar_t intersection,
+                 wchar_t right) {
+        addwch(left);
+        for (int c = 0; c < n; ++c) {
+            if (c != 0) {
+                addwch(intersection);
+            }
+            for (int i = 0; i < style.cell_width; ++i) {
+                add(std::wstring(1, plain), 1, A_BOLD, 0);
+            }
+        }
+        addwch(right);
+        end_line();
+    }
+    void top_row(int n) {
+        const auto& box = style.box_style;
+        sep_row(n, box.corners.top_left, box.borders.horizontal,
+                box.intersections.top, box.corners.top_right);
+    }
+    void bottom_row(int n) {
+        const auto& box = style.box_style;
+        sep_row(n, box.corners.bottom_left, box.borders.horizontal,
+                box.intersections.bottom, box.corners.bottom_right);
+    }
+    void middle_row(int n) {
+        const auto& box = style.box_style;
+        sep_row(n, box.intersections.left, box.borders.horizontal,
+                box.intersections.center, box.intersections.right);
+    }
+    void values(const std::vector<Cell>& row) {
+        const auto& box = style.box_style;
+        auto padding_row = row;
+        for (auto& cell : padding_row) {
+            cell.content = std::wstring(style.cell_width, L' ');
+        }
+        const auto line_height = 1;
+        const auto top_pad = (style.cell_height - line_height) / 2;
+        for (auto i = 0; i < top_pad; ++i) {
+            value_row(padding_row, box.borders.vertical, box.borders.vertical,
+                      box.borders.vertical);
+        }
+        value_row(row, box.borders.vertical, box.borders.vertical,
+                  box.borders.vertical);
+        auto bottom_pad = style.cell_height - (top_pad + line_height);
+        for (auto i = 0; i < bottom_pad; ++i) {
+            value_row(padding_row, box.borders.vertical, box.borders.vertical,
+                      box.borders.vertical);
+        }
+    }
+
+    MemoryBackend& memory;
+    const MatrixStyle style;
+    int y = 0;
+    int x = 0;
+};
+
+// The framebuffer of a lines by cols target after a print of grid from its
+// top left corner: the cells whose inside starts on the target, cut by its
+// edges, and the cursor below the matrix.
+MemoryBackend reference(const MatrixStyle& style, const CellGrid& grid,
+                        int lines, int cols) {
+    MemoryBackend memory(lines, cols);
+    const auto fitting = [](int available, int cell_size) {
+        return std::max(0, (available - 1 + cell_size) / (cell_size + 1));
+    };
+    const auto rows = std::min(grid.rows(), fitting(lines, style.cell_height));
+    const auto shown_cols =
+        std::min(grid.cols(), fitting(cols, style.cell_width));
+    ReferencePrint(memory, style).print(0, grid, rows, shown_cols);
+    memory.move(MatrixGeometry(rows, shown_cols, style).height(), 0);
+    return memory;
+}
+MemoryBackend reference(const MatrixStyle& style, const CellGrid& grid) {
+    const auto geometry = MatrixGeometry(grid.rows(), grid.cols(), style);
+    return reference(style, grid, geometry.height(), geometry.width());
+}
+
+// Fails state unless drawn holds the reference framebuffer of grid.
+bool same(benchmark::State& state, const char* path,
+          const MemoryBackend& expected, const MemoryBackend& drawn) {
+    if (drawn == expected) {
+        return true;
+    }
+    fail(state, std::string(path) + " draws another picture than print");
+    return false;
+}
+bool same(benchmark::State& state, const char* path, const MatrixStyle& style,
+          const CellGrid& grid, const MemoryBackend& drawn) {
+    return same(state, path, reference(style, grid), drawn);
+}
+
+// Checks a frame of the loop of state against budgets, as numbers per frame;
+// a negative budget isn't checked.
+bool within(benchmark::State& state, const char* what, long spent,
+            long budget) {
+    if (budget < 0 || spent <= budget) {
+        return true;
+    }
+    fail(state, std::string(what) + ": " + std::to_string(spent) +
+                    " per frame, over the budget of " +
+                    std::to_string(budget));
+    return false;
+}
+
+// Incremental frames with a few cells changed each: the picture must be the
+// one a full print gives, with no allocation and one call per line of each
+// cell rewritten.
+void BM_CheckIncremental(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto geometry = MatrixGeometry(n, n, style);
+    MemoryBackend memory(geometry.height(), geometry.width());
+    MatrixDisplay display(style, Redraw::incremental);
+    CellGrid frames[8];
+    for (int frame = 0; frame < 8; ++frame) {
+        frames[frame] = reference_grid(n, n, frame);
+    }
+    // A first round grows the buffers of the display to the longest
+    // contents.
+    for (int frame = 0; frame < 8; ++frame) {
+        display.print(memory, 0, 0, frames[frame]);
+    }
+    for (int frame = 0; frame < 8; ++frame) {
+        const auto& before = frames[(frame + 7) % 8];
+        [[maybe_unused]] long changed = 0;
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                changed += frames[frame](r, c) != before(r, c);
+            }
+        }
+        CURSED_STATS(display.reset_stats());
+        const auto allocations_before = allocations.load();
+        display.print(memory, 0, 0, frames[frame]);
+        const auto frame_allocations = allocations.load() - allocations_before;
+        if (!same(state, "an incremental print", style, frames[frame],
+                  memory) ||
+            !within(state, "allocations", frame_allocations, 0)) {
+            return;
+        }
+        CURSED_STATS(if (!within(state, "calls", display.stats().calls,
+                                 changed * style.cell_height)) { return; });
+    }
+    int frame = 0;
+    for (auto _ : state) {
+        display.print(memory, 0, 0, frames[frame++ & 7]);
+    }
+}
+BENCHMARK(BM_CheckIncremental)
+    ->ArgNames({"n", "cell_width", "cell_height"})
+    ->ArgsProduct({{8, 64}, {3, 6}, {1, 3}});
+
+// The same matrix through every other way of giving it to print.
+void BM_CheckProviders(benchmark::State& state) {
+    const int n = state.range(0);
+    const MatrixStyle style(6, 3);
+    const auto grid = reference_grid(n, n, 0);
+    const auto geometry = MatrixGeometry(n, n, style);
+    MemoryBackend memory(geometry.height(), geometry.width());
+    auto check = [&](const char* path, auto print) {
+        memory.clear();
+        print();
+        return same(state, path, style, grid, memory);
+    };
+    std::vector<std::vector<Cell>> nested(n);
+    LabelPool pool;
+    LabelGrid labels(n, n);
+    FrameBuffer buffer(n, n);
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            const auto cell = grid(r, c);
+            nested[r].emplace_back(std::wstring(cell.content),
+                                   cell.color_code);
+            labels.set(r, c, pool.intern(cell.content), cell.color_code);
+            buffer.back().set(r, c, cell.content, cell.color_code);
+        }
+    }
+    buffer.publish();
+    MatrixDisplay display(style);
+    MatrixDisplay parallel(style, Redraw::full, 4);
+    // A provider formatting every cell into the same buffer, which must be
+    // called once per cell by the thread that prints.
+    std::wstring scratch;
+    long provider_calls = 0;
+    auto formatted = [&](int r, int c) {
+        ++provider_calls;
+        scratch = grid(r, c).content;
+        return CellView{scratch, grid(r, c).color_code};
+    };
+    const auto ok =
+        check("nested vectors",
+              [&] { display.print(memory, 0, 0, nested); }) &&
+        check("a provider",
+              [&] {
+                  display.print(memory, 0, 0, n, n, [&](int r, int c) {
+                      return grid(r, c);
+                  });
+              }) &&
+        check("labels", [&] { display.print(memory, 0, 0, n, n, labels); }) &&
+        check("a frame buffer",
+              [&] { display.print(memory, 0, 0, buffer); }) &&
+        check("parallel formatting",
+              [&] { parallel.print(memory, 0, 0, grid); }) &&
+        check("a provider with one buffer",
+              [&] { parallel.print(memory, 0, 0, n, n, formatted); }) &&
+        within(state, "provider calls", provider_calls,
+               static_cast<long>(n) * n);
+    if (!ok) {
+        return;
+    }
+    for (auto _ : state) {
+        parallel.print(memory, 0, 0, grid);
+    }
+}
+BENCHMARK(BM_CheckProviders)->ArgName("n")->Arg(8)->Arg(100);
+
+// Numbers formatted by print, against the cells callers used to make.
+void BM_CheckNumbers(benchmark::State& state) {
+    const int n = state.range(0);
+    const MatrixStyle style(6, 1);
+    const auto values = make_metrics(n);
+    CellGrid grid(n, n);
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            const auto value = values[r * n + c];
+            int color = 0;
+            while (color < 3 && value >= metrics_format.thresholds[color]) {
+                ++color;
+            }
+            const auto text = std::to_wstring(value);
+            grid.set(r, c, text.substr(0, text.find(L'.') + 3),
+                     metrics_format.color_codes[color]);
+        }
+    }
+    const auto geometry = MatrixGeometry(n, n, style);
+    MemoryBackend memory(geometry.height(), geometry.width());
+    MatrixDisplay display(style);
+    display.print(memory, 0, 0, values, n, n, metrics_format);
+    if (!same(state, "a numeric print", style, grid, memory)) {
+        return;
+    }
+    for (auto _ : state) {
+        display.print(memory, 0, 0, values, n, n, metrics_format);
+    }
+}
+BENCHMARK(BM_CheckNumbers)->ArgName("n")->Arg(8)->Arg(64);
+
+// Deltas serialized, parsed and applied to the frame of a display, which
+// must then draw the frame the deltas were made from.
+void BM_CheckDelta(benchmark::State& state) {
+    const int n = state.range(0);
+    const MatrixStyle style(4, 1);
+    const auto geometry = MatrixGeometry(n, n, style);
+    MemoryBackend memory(geometry.height(), geometry.width());
+    MatrixDisplay display(style, Redraw::incremental);
+    CellGrid before;
+    FrameDelta delta;
+    for (int frame = 0; frame < 8; ++frame) {
+        const auto after = reference_grid(n, n, frame);
+        diff(before, after, delta);
+        const auto parsed = FrameDelta::parse(delta.serialize());
+        if (!parsed || !display.apply(*parsed)) {
+            fail(state, "a delta doesn't apply to the frame it came from");
+            return;
+        }
+        display.print(memory, 0, 0);
+        if (!same(state, "a delta applied", style, after, memory)) {
+            return;
+        }
+        before = after;
+    }
+    // Shapes of more than max_cells cells are rejected before apply would
+    // allocate them.
+    FrameDelta shape;
+    shape.reset(2048, 2048, true);
+    const auto largest = FrameDelta::parse(shape.serialize());
+    shape.reset(2048, 2049, true);
+    const auto larger = FrameDelta::parse(shape.serialize());
+    shape.reset(1 << 24, 1 << 24, true);
+    if (!largest || larger || FrameDelta::parse(shape.serialize())) {
+        fail(state, "a delta of more than max_cells cells parses");
+        return;
+    }
+    for (auto _ : state) {
+        diff(before, reference_grid(n, n, 0), delta);
+        benchmark::DoNotOptimize(delta.serialize());
+    }
+}
+BENCHMARK(BM_CheckDelta)->ArgName("n")->Arg(8)->Arg(64);
+
+// Incremental prints on a target resized between the frames, which reflow
+// the previous frame: the picture must be the one a print on a target of the
+// new size gives.
+void BM_CheckReflow(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto geometry = MatrixGeometry(n, n, style);
+    const int lines = geometry.height();
+    const int cols = geometry.width();
+    // Shrinking, growing past the matrix, and cutting cells on either edge.
+    const int sizes[][2] = {{lines, cols},         {lines / 2, cols},
+                            {lines / 2, cols / 2}, {lines, cols / 2 + 1},
+                            {lines + 3, cols + 4}, {lines - 1, cols - 1},
+                            {lines, cols}};
+    MemoryBackend memory(lines, cols);
+    MatrixDisplay display(style, Redraw::incremental);
+    int frame = 0;
+    for (const auto& size : sizes) {
+        memory.resize(size[0], size[1]);
+        const auto grid = reference_grid(n, n, frame++);
+        display.print(memory, 0, 0, grid);
+        if (!same(state, "a reflow",
+                  reference(style, grid, size[0], size[1]), memory)) {
+            return;
+        }
+    }
+    const CellGrid frames[] = {reference_grid(n, n, 0),
+                               reference_grid(n, n, 1)};
+    for (auto _ : state) {
+        const auto& size = sizes[1 + (frame & 1)];
+        memory.resize(size[0], size[1]);
+        display.print(memory, 0, 0, frames[frame++ & 1]);
+    }
+}
+BENCHMARK(BM_CheckReflow)
+    ->ArgNames({"n", "cell_width", "cell_height"})
+    ->ArgsProduct({{8, 64}, {3, 6}, {1, 3}});
+
+// Rows streamed into a target a few rows high, which scrolls once it is
+// full: it must show the bottom of a print of all the rows appended.
+void BM_CheckAppend(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const int cols = 8;
+    const auto grid = reference_grid(n, cols, 0);
+    // One line more than three rows take, so that the rows don't always
+    // scroll by whole rows.
+    const int lines = MatrixGeometry(3, cols, style).height() + 1;
+    const int width = MatrixGeometry(3, cols, style).width();
+    MemoryBackend memory(lines, width);
+    MatrixDisplay display(style);
+    for (int r = 0; r < n; ++r) {
+        display.append(memory, cols, grid, r);
+        MemoryBackend expected(lines, width);
+        const auto height = MatrixGeometry(r + 1, cols, style).height();
+        ReferencePrint(expected, style)
+            .print(std::min(0, lines - height), grid, r + 1, cols);
+        if (!same(state, "an append", expected, memory)) {
+            return;
+        }
+    }
+    int r = 0;
+    for (auto _ : state) {
+        display.append(memory, cols, grid, r++ % n);
+    }
+}
+BENCHMARK(BM_CheckAppend)
+    ->ArgNames({"n", "cell_width", "cell_height"})
+    ->ArgsProduct({{16}, {3, 6}, {1, 3}});
+
+// Cells rewritten one at a time by update_cell, which must give the picture
+// of a print of the grid they were changed in, and leave nothing for the
+// next incremental print to fix.
+void BM_CheckUpdateCell(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    auto grid = reference_grid(n, n, 0);
+    const auto geometry = MatrixGeometry(n, n, style);
+    MemoryBackend memory(geometry.height(), geometry.width());
+    MatrixDisplay display(style, Redraw::incremental);
+    display.print(memory, 0, 0, grid);
+    for (int i = 0; i < 12; ++i) {
+        const auto r = i * 5 % n;
+        const auto c = i * 3 % n;
+        display.update_cell(memory, r, c, samples[i % 6], i % 8);
+        grid.set(r, c, samples[i % 6], i % 8);
+        if (!same(state, "update_cell", style, grid, memory)) {
+            return;
+        }
+    }
+    // Outside of the matrix, which is left as it is.
+    display.update_cell(memory, n, 0, L"x");
+    display.update_cell(memory, 0, -1, L"x");
+    if (!same(state, "update_cell outside of the matrix", style, grid,
+              memory)) {
+        return;
+    }
+    CURSED_STATS(display.reset_stats());
+    display.print(memory, 0, 0, grid);
+    if (!same(state, "a print after update_cell", style, grid, memory)) {
+        return;
+    }
+    CURSED_STATS(if (!within(state, "calls after update_cell",
+                             display.stats().calls, 0)) { return; });
+    int i = 0;
+    for (auto _ : state) {
+        display.update_cell(memory, n / 2, n / 2, samples[i % 6], i % 8);
+        ++i;
+    }
+}
+BENCHMARK(BM_CheckUpdateCell)
+    ->ArgNames({"n", "cell_width", "cell_height"})
+    ->ArgsProduct({{8, 64}, {3, 6}, {1, 3}});
+
+// Cells overwritten behind the back of the display: an incremental print
+// must rewrite the ones invalidated, and only those.
+void BM_CheckInvalidate(benchmark::State& state) {
+    const int n = state.range(0);
+    const auto style = style_of(state);
+    const auto grid = reference_grid(n, n, 0);
+    const auto geometry = MatrixGeometry(n, n, style);
+    MemoryBackend memory(geometry.height(), geometry.width());
+    MatrixDisplay display(style, Redraw::incremental);
+    display.print(memory, 0, 0, grid);
+    const auto junk = wide_char(L'#');
+    auto overwrite = [&](int r, int c) {
+        for (int i = 0; i < style.cell_height; ++i) {
+            for (int j = 0; j < style.cell_width; ++j) {
+                memory.put(geometry.cell_y(r) + i, geometry.cell_x(c) + j,
+                           &junk, 1);
+            }
+        }
+    };
+    const auto row = n / 2;
+    for (int c = 0; c < n; ++c) {
+        overwrite(row, c);
+    }
+    overwrite(0, n - 1);
+    overwrite(n - 1, 0);
+    display.invalidate_row(row);
+    display.invalidate_cell(0, n - 1);
+    display.invalidate_cell(n - 1, 0);
+    CURSED_STATS(display.reset_stats());
+    display.print(memory, 0, 0, grid);
+    if (!same(state, "a print after invalidate_row and invalidate_cell",
+              style, grid, memory)) {
+        return;
+    }
+    CURSED_STATS(if (!within(state, "calls after invalidate",
+                             display.stats().calls,
+                             (n + 2) * style.cell_height)) { return; });
+    for (auto _ : state) {
+        display.invalidate_row(row);
+        display.print(memory, 0, 0, grid);
+    }
+}
+BENCHMARK(BM_CheckInvalidate)
+    ->ArgNames({"n", "cell_width", "cell_height"})
+    ->ArgsProduct({{8, 64}, {3, 6}, {1, 3}});
+
+// What reaches the terminal when one cell changes per frame: a few bytes,
+// and nothing at all for a frame that is drawn again unchanged.
+void BM_CheckTerminalBytes(benchmark::State& state) {
+    const int n = state.range(0);
+    const MatrixStyle style(4, 1);
+    fit_screen(style, n, n);
+    auto grid = reference_grid(n, n, 0);
+    MatrixDisplay display(style, Redraw::incremental);
+    auto frame = [&] {
+        display.print(stdscr, 0, 0, grid);
+        wnoutrefresh(stdscr);
+        doupdate();
+        return headless->bytes_emitted();
+    };
+    frame();
+    if (!within(state, "bytes of an unchanged frame", frame(), 0)) {
+        return;
+    }
+    grid.set(n / 2, n / 2, L"*", 1);
+    if (!within(state, "bytes of a frame with one change", frame(), 64)) {
+        return;
+    }
+    int i = 0;
+    for (auto _ : state) {
+        grid.set(n / 2, n / 2, i++ & 1 ? L"*" : L"#", 1);
+        frame();
+    }
+}
+BENCHMARK(BM_CheckTerminalBytes)->ArgName("n")->Arg(8)->Arg(64);
+
+// Pairs asked for on a terminal without colors, where ColorScheme used to
+// be harmless: they must all be pair 0.
+void BM_CheckMonochrome(benchmark::State& state) {
+    const auto output = std::fopen("/dev/null", "w");
+    const auto input = std::fopen("/dev/null", "r");
+    const auto screen = newterm("vt100", output, input);
+    if (screen == nullptr) {
+        fail(state, "cannot open a vt100 terminal");
+    } else {
+        PairCache pairs;
+        const ColorScheme scheme({COLOR_RED, COLOR_GREEN});
+        const auto ok = pairs.pair(COLOR_BLACK, COLOR_RED) == 0 &&
+                        pairs.size() == 0 && scheme.pair(0) == 0 &&
+                        scheme.pair(1) == 0;
+        endwin();
+        delscreen(screen);
+        if (!ok) {
+            fail(state, "a terminal without colors gets color pairs");
+        }
+    }
+    std::fclose(output);
+    std::fclose(input);
+    headless->select();
+    for (auto _ : state) {
+    }
+}
+BENCHMARK(BM_CheckMonochrome)->Iterations(1);
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::setlocale(LC_ALL, "");
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return EXIT_FAILURE;
+    }
+    HeadlessScreen screen;
+    headless = &screen;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return failed_checks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
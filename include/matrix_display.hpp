@@ -5,27 +5,145 @@
 #include <boost/range/algorithm/for_each.hpp>
 #include <boost/range/algorithm/transform.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
 #include <cstdlib>
+#include <cwchar>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <list>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Wraps the statements that record statistics, which are compiled out unless
+// CURSED_ENABLE_STATS is defined.
+#ifdef CURSED_ENABLE_STATS
+#define CURSED_STATS(...) __VA_ARGS__
+#else
+#define CURSED_STATS(...)
+#endif
+
 namespace ncurses {
 
+// Color pairs made on demand for the (foreground, background) combinations
+// that are drawn. Once every pair is in use, the least recently asked for is
+// redefined, which recolors what was drawn with it on the next refresh.
+class PairCache {
+   public:
+    // capacity is the number of pairs the cache may define from first_pair
+    // on, at most what the terminal has. 0 means as many as the terminal has.
+    explicit PairCache(int first_pair_ = 1, int capacity_ = 0)
+        : first_pair(first_pair_), capacity(capacity_) {
+        assert(first_pair_ > 0);
+    }
+    PairCache(const PairCache&) = delete;
+    PairCache& operator=(const PairCache&) = delete;
+    // The pair of the combination, defined the first time it is asked for.
+    // It requires start_color to have been called. Without colors, e.g. on a
+    // monochrome terminal, every combination is drawn with pair 0.
+    int pair(int foreground, int background) {
+        const auto key = static_cast<std::uint64_t>(foreground) << 32 |
+                         static_cast<std::uint32_t>(background);
+        if (const auto found = pairs.find(key); found != pairs.end()) {
+            recent.splice(recent.begin(), recent, found->second);
+            return found->second->pair;
+        }
+        if (limit < 0) {
+            // Pairs are passed around as shorts, so extended pairs above
+            // that are left alone.
+            const auto available =
+                has_colors() ? std::min(COLOR_PAIRS, 32768) - first_pair : 0;
+            if (available <= 0) {
+                return 0;
+            }
+            limit = capacity > 0 ? std::min(capacity, available) : available;
+        }
+        int pair;
+        if (static_cast<int>(recent.size()) < limit) {
+            pair = first_pair + recent.size();
+            recent.push_front({key, pair});
+        } else {
+            assert(!recent.empty());
+            pairs.erase(recent.back().key);
+            recent.splice(recent.begin(), recent, std::prev(recent.end()));
+            recent.front().key = key;
+            pair = recent.front().pair;
+        }
+        pairs.emplace(key, recent.begin());
+#ifdef NCURSES_EXT_COLORS
+        init_extended_pair(pair, foreground, background);
+#else
+        init_pair(pair, foreground, background);
+#endif
+        return pair;
+    }
+    // Number of pairs defined.
+    int size() const { return recent.size(); }
+
+   private:
+    struct Entry {
+        std::uint64_t key;
+        int pair;
+    };
+    const int first_pair;
+    const int capacity;
+    int limit = -1;
+    // From the most to the least recently used.
+    std::list<Entry> recent;
+    std::unordered_map<std::uint64_t, std::list<Entry>::iterator> pairs;
+};
+
+// The cache the color schemes of a program share, so that they never define
+// the same pair twice.
+inline PairCache& color_pairs() {
+    static PairCache cache;
+    return cache;
+}
+
+// Background colors on a black foreground, whose color codes are given by
+// pair. Pairs are only defined for the colors that get used.
 class ColorScheme {
    public:
     ColorScheme(const std::vector<int>& scheme_) : scheme(scheme_) {
         start_color();
-        int index = 0;
-        for (const auto& color : scheme) {
-            init_pair(index++, COLOR_BLACK, color);
-        }
+    }
+    // Color code of the index-th color of the scheme. Pair 0 can't be
+    // redefined, so no index maps to it.
+    int pair(int index) const {
+        assert(index >= 0 && index < static_cast<int>(scheme.size()));
+        return color_pairs().pair(COLOR_BLACK, scheme[index]);
     }
     std::vector<int> scheme;
 };
 
 class Color {
    public:
-    Color(int n) {
+    Color(int n_) : n(n_) {
         attron(COLOR_PAIR(n));
         attron(A_BOLD);
     }
@@ -39,14 +157,607 @@ class Color {
 };
 
 struct Cell {
-    Cell(const auto& s, int c = 0) : content(s), color_code(c) {}
+    // Moves the content in when it is a temporary string.
+    template <class S>
+        requires std::constructible_from<std::wstring, S&&>
+    Cell(S&& s, int c = 0) : content(std::forward<S>(s)), color_code(c) {}
+    bool operator==(const Cell&) const = default;
     std::wstring content;
     int color_code;
 };
 
+// Number of terminal columns taken by text: wide glyphs such as CJK or emoji
+// take two, combining and non printable characters none. Printable ASCII is
+// recognised first, so most contents don't need a single wcwidth call.
+inline int display_width(std::wstring_view text) {
+    const auto ascii = std::all_of(text.begin(), text.end(), [](wchar_t c) {
+        return c >= 0x20 && c < 0x7f;
+    });
+    if (ascii) {
+        return text.length();
+    }
+    int width = 0;
+    for (const auto c : text) {
+        width += std::max(0, wcwidth(c));
+    }
+    return width;
+}
+
+// Appends the UTF-8 encoding of glyph to out.
+inline void append_utf8(char32_t glyph, std::string& out) {
+    if (glyph < 0x80) {
+        out.push_back(glyph);
+    } else if (glyph < 0x800) {
+        out.push_back(0xc0 | glyph >> 6);
+        out.push_back(0x80 | (glyph & 0x3f));
+    } else if (glyph < 0x10000) {
+        out.push_back(0xe0 | glyph >> 12);
+        out.push_back(0x80 | (glyph >> 6 & 0x3f));
+        out.push_back(0x80 | (glyph & 0x3f));
+    } else {
+        out.push_back(0xf0 | glyph >> 18);
+        out.push_back(0x80 | (glyph >> 12 & 0x3f));
+        out.push_back(0x80 | (glyph >> 6 & 0x3f));
+        out.push_back(0x80 | (glyph & 0x3f));
+    }
+}
+inline void append_utf8(std::wstring_view text, std::string& out) {
+    for (const auto glyph : text) {
+        append_utf8(static_cast<char32_t>(glyph), out);
+    }
+}
+// Appends the characters encoded in UTF-8 by bytes to out, and returns false
+// when bytes is not valid UTF-8.
+inline bool append_decoded_utf8(std::string_view bytes, std::wstring& out) {
+    for (std::size_t i = 0; i < bytes.size();) {
+        const auto lead = static_cast<unsigned char>(bytes[i]);
+        const int length = lead < 0x80   ? 1
+                           : lead < 0xc2 ? 0
+                           : lead < 0xe0 ? 2
+                           : lead < 0xf0 ? 3
+                           : lead < 0xf5 ? 4
+                                         : 0;
+        if (length == 0 || i + length > bytes.size()) {
+            return false;
+        }
+        char32_t glyph = length == 1 ? lead : lead & (0x7f >> length);
+        for (int k = 1; k < length; ++k) {
+            const auto next = static_cast<unsigned char>(bytes[i + k]);
+            if ((next & 0xc0) != 0x80) {
+                return false;
+            }
+            glyph = glyph << 6 | (next & 0x3f);
+        }
+        out.push_back(glyph);
+        i += length;
+    }
+    return true;
+}
+
+// Non owning view of a cell's content and color. width is the display width
+// of the content, or -1 when it hasn't been computed yet.
+struct CellView {
+    bool operator==(const CellView& other) const {
+        if (label != 0 && label == other.label) {
+            return color_code == other.color_code;
+        }
+        return content == other.content && color_code == other.color_code;
+    }
+    std::wstring_view content;
+    int color_code = 0;
+    int width = -1;
+    // Id of the interned label the content comes from, or 0: cells of the
+    // same label are equal without comparing their text.
+    std::uint32_t label = 0;
+};
+
+// Row-major grid of cells. The cells are stored in a single buffer and their
+// contents in a single text arena, rather than one allocation per row and one
+// per cell as with std::vector<std::vector<Cell>>.
+// Every cell reserves text_capacity characters of the arena, so setting
+// contents up to that length never allocates. The display width of each
+// content is computed once, when it is set.
+class CellGrid {
+   public:
+    static constexpr int default_text_capacity = 8;
+
+    CellGrid() = default;
+    CellGrid(int rows_, int cols_, int text_capacity_ = default_text_capacity)
+        : text_capacity(text_capacity_) {
+        resize(rows_, cols_);
+    }
+    explicit CellGrid(const std::vector<std::vector<Cell>>& data) {
+        assign(data);
+    }
+
+    int rows() const { return row_count; }
+    int cols() const { return col_count; }
+    bool empty() const { return slots.empty(); }
+
+    CellView operator()(int row, int col) const {
+        const auto& slot = slots[index(row, col)];
+        return {std::wstring_view(text.data() + slot.offset, slot.length),
+                slot.color_code, static_cast<int>(slot.width), slot.label};
+    }
+    // width is the display width of content when the caller already knows it.
+    void set(int row, int col, std::wstring_view content, int color_code = 0,
+             int width = -1) {
+        auto& slot = slots[index(row, col)];
+        if (content.length() > slot.capacity) {
+            // Move the cell to a larger region at the end of the arena.
+            slot.capacity = std::max<std::uint32_t>(content.length(),
+                                                    2 * slot.capacity);
+            slot.offset = text.size();
+            text.resize(text.size() + slot.capacity);
+        }
+        content.copy(text.data() + slot.offset, content.length());
+        slot.length = content.length();
+        slot.width = width < 0 ? display_width(content) : width;
+        slot.color_code = color_code;
+        slot.label = 0;
+    }
+    // Keeps the label of the cell, so that comparing the cell with others of
+    // the same label doesn't compare their text.
+    void set(int row, int col, CellView cell) {
+        set(row, col, cell.content, cell.color_code, cell.width);
+        slots[index(row, col)].label = cell.label;
+    }
+
+    // Changes the shape of the grid and empties every cell. The buffers are
+    // reused when the shape doesn't change.
+    void resize(int rows_, int cols_) {
+        row_count = rows_;
+        col_count = cols_;
+        const auto n = static_cast<std::size_t>(rows_) * cols_;
+        slots.resize(n);
+        text.resize(n * text_capacity);
+        for (std::size_t i = 0; i < n; ++i) {
+            slots[i] = Slot{static_cast<std::uint32_t>(i * text_capacity), 0,
+                            static_cast<std::uint32_t>(text_capacity), 0, 0,
+                            0};
+        }
+    }
+    // Copies nested vectors into the grid. Every row must have as many cells
+    // as the first one.
+    void assign(const std::vector<std::vector<Cell>>& data) {
+        const int rows_ = data.size();
+        const int cols_ = data.empty() ? 0 : data[0].size();
+        if (rows_ != row_count || cols_ != col_count) {
+            resize(rows_, cols_);
+        }
+        for (int r = 0; r < rows_; ++r) {
+            assert(static_cast<int>(data[r].size()) == cols_);
+            for (int c = 0; c < cols_; ++c) {
+                set(r, c, data[r][c].content, data[r][c].color_code);
+            }
+        }
+    }
+
+   private:
+    struct Slot {
+        std::uint32_t offset;
+        std::uint32_t length;
+        std::uint32_t capacity;
+        std::uint32_t width;
+        int color_code;
+        std::uint32_t label;
+    };
+    std::size_t index(int row, int col) const {
+        assert(row >= 0 && row < row_count && col >= 0 && col < col_count);
+        return static_cast<std::size_t>(row) * col_count + col;
+    }
+
+    int row_count = 0;
+    int col_count = 0;
+    int text_capacity = default_text_capacity;
+    std::vector<Slot> slots;
+    std::vector<wchar_t> text;
+};
+
+// A text interned by a LabelPool, with its display width. Labels are never
+// moved, and each has an id of its own among all the pools.
+struct Label {
+    std::wstring_view text;
+    int width = 0;
+    std::uint32_t id = 0;
+};
+
+// Stores each distinct text of cells once, for grids that repeat a small set
+// of labels such as "OK", "WARN" or "--". The texts and the labels live in an
+// arena that is only released with the pool.
+class LabelPool {
+   public:
+    LabelPool() = default;
+    LabelPool(const LabelPool&) = delete;
+    LabelPool& operator=(const LabelPool&) = delete;
+    // The label of text, which is only copied the first time it is seen.
+    const Label& intern(std::wstring_view text) {
+        if (const auto found = labels.find(text); found != labels.end()) {
+            return found->second;
+        }
+        auto storage = static_cast<wchar_t*>(arena.allocate(
+            std::max<std::size_t>(1, text.length()) * sizeof(wchar_t),
+            alignof(wchar_t)));
+        text.copy(storage, text.length());
+        const std::wstring_view interned(storage, text.length());
+        const Label label{interned, display_width(interned),
+                          next_id.fetch_add(1, std::memory_order_relaxed)};
+        return labels.emplace(interned, label).first->second;
+    }
+    std::size_t size() const { return labels.size(); }
+
+   private:
+    static inline std::atomic<std::uint32_t> next_id{1};
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::unordered_map<std::wstring_view, Label> labels{&arena};
+};
+
+// A grid whose cells are labels of a LabelPool, which must outlive it:
+// setting a cell writes a pointer and a color, and never allocates.
+class LabelGrid {
+   public:
+    LabelGrid(int rows_, int cols_)
+        : row_count(rows_),
+          col_count(cols_),
+          cells(static_cast<std::size_t>(rows_) * cols_) {}
+
+    int rows() const { return row_count; }
+    int cols() const { return col_count; }
+    bool empty() const { return cells.empty(); }
+
+    CellView operator()(int row, int col) const {
+        const auto& cell = cells[index(row, col)];
+        if (cell.label == nullptr) {
+            return {{}, cell.color_code, 0};
+        }
+        return {cell.label->text, cell.color_code, cell.label->width,
+                cell.label->id};
+    }
+    void set(int row, int col, const Label& label, int color_code = 0) {
+        cells[index(row, col)] = {&label, color_code};
+    }
+
+   private:
+    struct Entry {
+        const Label* label = nullptr;
+        int color_code = 0;
+    };
+    std::size_t index(int row, int col) const {
+        assert(row >= 0 && row < row_count && col >= 0 && col < col_count);
+        return static_cast<std::size_t>(row) * col_count + col;
+    }
+
+    int row_count;
+    int col_count;
+    std::vector<Entry> cells;
+};
+
+// Hands frames from a producer thread to a rendering thread without either
+// of them waiting for the other. The producer fills back() and publishes it,
+// the renderer acquires the latest published frame and reads it as front().
+// The three grids rotate through an atomic that holds the index of the grid
+// in the middle and the sequence number of the frame it holds, so frames
+// published faster than they are rendered are skipped rather than queued.
+class FrameBuffer {
+   public:
+    FrameBuffer(int rows, int cols,
+                int text_capacity = CellGrid::default_text_capacity)
+        : grids{CellGrid(rows, cols, text_capacity),
+                CellGrid(rows, cols, text_capacity),
+                CellGrid(rows, cols, text_capacity)} {}
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    // Producer side. The contents of the back grid are unspecified: it may
+    // hold any frame published before the previous one, or one the renderer
+    // was done with. Every cell has to be written before publishing it.
+    CellGrid& back() { return grids[back_index]; }
+    void publish() {
+        const auto state = middle.exchange(++published << 2 | back_index,
+                                           std::memory_order_acq_rel);
+        back_index = state & 3;
+    }
+
+    // Renderer side. Makes the latest published frame the front one and
+    // returns true, or returns false when nothing was published since the
+    // previous call.
+    bool acquire() {
+        if (middle.load(std::memory_order_relaxed) >> 2 <= front_sequence) {
+            return false;
+        }
+        const auto state = middle.exchange(front_sequence << 2 | front_index,
+                                           std::memory_order_acq_rel);
+        front_index = state & 3;
+        skipped_frames += (state >> 2) - front_sequence - 1;
+        front_sequence = state >> 2;
+        return true;
+    }
+    const CellGrid& front() const { return grids[front_index]; }
+    // Sequence number of the front frame, the first published frame being 1.
+    std::uint64_t sequence() const { return front_sequence; }
+    // Frames that were published but never acquired.
+    std::uint64_t skipped() const { return skipped_frames; }
+
+   private:
+    CellGrid grids[3];
+    std::atomic<std::uint64_t> middle{1};
+    // Only used by the producer.
+    int back_index = 0;
+    std::uint64_t published = 0;
+    // Only used by the renderer.
+    int front_index = 2;
+    std::uint64_t front_sequence = 0;
+    std::uint64_t skipped_frames = 0;
+};
+
+// The cells that changed between two frames of a matrix, for sending frames
+// over a slow link: its size is proportional to the changes rather than to
+// the matrix. Changed cells that follow each other on a row and share a
+// color form a run, which stores the color once. A full delta replaces the
+// whole frame, and is what a change of shape gives.
+class FrameDelta {
+   public:
+    struct Run {
+        bool operator==(const Run&) const = default;
+        int row;
+        int first_col;
+        int length;
+        int color_code;
+    };
+    bool operator==(const FrameDelta&) const = default;
+    // The most cells a parsed delta can have, so that a remote sender can't
+    // make apply allocate more than a few hundred megabytes, far from where
+    // the offsets of a CellGrid would overflow.
+    static constexpr std::uint64_t max_cells = 1 << 22;
+    static_assert(max_cells * CellGrid::default_text_capacity < 1ull << 32);
+
+    int rows() const { return row_count; }
+    int cols() const { return col_count; }
+    bool full() const { return is_full; }
+    bool empty() const { return runs_.empty(); }
+    const std::vector<Run>& runs() const { return runs_; }
+    // Content of the i-th changed cell, counting the cells of every run.
+    std::wstring_view text(std::size_t i) const {
+        const auto begin = i == 0 ? 0 : ends[i - 1];
+        return std::wstring_view(texts).substr(begin, ends[i] - begin);
+    }
+    std::size_t cells() const { return ends.size(); }
+
+    // Empties the delta, keeping its buffers, for a frame of the given shape.
+    void reset(int rows_, int cols_, bool full_) {
+        row_count = rows_;
+        col_count = cols_;
+        is_full = full_;
+        runs_.clear();
+        texts.clear();
+        ends.clear();
+    }
+    // Adds a changed cell, after the ones already added.
+    void add(int row, int col, CellView cell) {
+        if (runs_.empty() || runs_.back().row != row ||
+            runs_.back().first_col + runs_.back().length != col ||
+            runs_.back().color_code != cell.color_code) {
+            runs_.push_back({row, col, 0, cell.color_code});
+        }
+        ++runs_.back().length;
+        texts.append(cell.content);
+        ends.push_back(texts.size());
+    }
+
+    // Wire format: the shape and the runs as variable length integers, each
+    // run followed by the UTF-8 texts of its cells, prefixed by their length.
+    std::string serialize() const {
+        std::string bytes;
+        put(bytes, row_count);
+        put(bytes, col_count);
+        put(bytes, is_full);
+        put(bytes, runs_.size());
+        std::size_t i = 0;
+        std::string text;
+        for (const auto& run : runs_) {
+            put(bytes, run.row);
+            put(bytes, run.first_col);
+            put(bytes, run.length);
+            put(bytes, zigzag(run.color_code));
+            for (int k = 0; k < run.length; ++k) {
+                text.clear();
+                append_utf8(this->text(i++), text);
+                put(bytes, text.size());
+                bytes += text;
+            }
+        }
+        return bytes;
+    }
+    // Reads a delta written by serialize, or returns nothing when bytes are
+    // not a valid delta or describe a frame of more than max_cells.
+    static std::optional<FrameDelta> parse(std::string_view bytes) {
+        FrameDelta delta;
+        std::uint64_t rows_, cols_, full_, n_runs;
+        if (!get(bytes, rows_) || !get(bytes, cols_) || !get(bytes, full_) ||
+            !get(bytes, n_runs) || rows_ > max_extent || cols_ > max_extent ||
+            rows_ * cols_ > max_cells || full_ > 1) {
+            return std::nullopt;
+        }
+        delta.reset(rows_, cols_, full_);
+        for (std::uint64_t n = 0; n < n_runs; ++n) {
+            std::uint64_t row, first_col, length, color;
+            if (!get(bytes, row) || !get(bytes, first_col) ||
+                !get(bytes, length) || !get(bytes, color) || row >= rows_ ||
+                first_col >= cols_ || length == 0 ||
+                length > cols_ - first_col) {
+                return std::nullopt;
+            }
+            delta.runs_.push_back({static_cast<int>(row),
+                                   static_cast<int>(first_col),
+                                   static_cast<int>(length), unzigzag(color)});
+            for (std::uint64_t k = 0; k < length; ++k) {
+                std::uint64_t size;
+                if (!get(bytes, size) || size > bytes.size() ||
+                    !append_decoded_utf8(bytes.substr(0, size),
+                                         delta.texts)) {
+                    return std::nullopt;
+                }
+                bytes.remove_prefix(size);
+                delta.ends.push_back(delta.texts.size());
+            }
+        }
+        if (!bytes.empty()) {
+            return std::nullopt;
+        }
+        return delta;
+    }
+
+   private:
+    static constexpr std::uint64_t max_extent = 1 << 24;
+    static std::uint64_t zigzag(int value) {
+        return (static_cast<std::uint64_t>(value) << 1) ^
+               static_cast<std::uint64_t>(static_cast<std::int64_t>(value) >>
+                                          63);
+    }
+    static int unzigzag(std::uint64_t value) {
+        return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+    }
+    static void put(std::string& bytes, std::uint64_t value) {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<char>(value));
+    }
+    static bool get(std::string_view& bytes, std::uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && !bytes.empty(); shift += 7) {
+            const auto byte = static_cast<unsigned char>(bytes.front());
+            bytes.remove_prefix(1);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int row_count = 0;
+    int col_count = 0;
+    bool is_full = false;
+    std::vector<Run> runs_;
+    std::wstring texts;
+    std::vector<std::size_t> ends;
+};
+
+// Fills delta with the cells of after that differ from before, or with all
+// of them when the two frames don't have the same shape.
+inline void diff(const CellGrid& before, const CellGrid& after,
+                 FrameDelta& delta) {
+    const auto full =
+        before.rows() != after.rows() || before.cols() != after.cols();
+    delta.reset(after.rows(), after.cols(), full);
+    for (int r = 0; r < after.rows(); ++r) {
+        for (int c = 0; c < after.cols(); ++c) {
+            const auto cell = after(r, c);
+            if (full || cell != before(r, c)) {
+                delta.add(r, c, cell);
+            }
+        }
+    }
+}
+inline FrameDelta diff(const CellGrid& before, const CellGrid& after) {
+    FrameDelta delta;
+    diff(before, after, delta);
+    return delta;
+}
+
+// How a matrix of numbers is shown: the digits after the decimal point of
+// floating point values, and the color code of each range of values. Values
+// below thresholds[0] get color_codes[0], values from thresholds[i - 1] on
+// and below thresholds[i] get color_codes[i], and so on, so color_codes has
+// one more element than the ascending thresholds. Without color codes,
+// every value gets 0.
+struct NumericFormat {
+    int precision = 2;
+    std::vector<double> thresholds;
+    std::vector<int> color_codes;
+};
+
+template <class T>
+concept Number = std::is_arithmetic_v<T> && !std::same_as<T, bool>;
+
+// Writes the index of the range of each value among thresholds to buckets.
+// The loop over the values is the inner one, so that it compiles to vector
+// compares and adds.
+template <Number T>
+void classify(std::span<const T> values, std::span<const double> thresholds,
+              int* buckets) {
+    std::fill_n(buckets, values.size(), 0);
+    for (const auto threshold : thresholds) {
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            buckets[i] += static_cast<double>(values[i]) >= threshold;
+        }
+    }
+}
+
+// Formats the values of a rows by cols matrix, stored row after row, into
+// grid, with their color codes. Numbers are written with std::to_chars, so
+// nothing depends on the locale and nothing is allocated once grid has the
+// right shape and room for the texts.
+template <Number T>
+void format_numbers(std::span<const T> values, int rows, int cols,
+                    const NumericFormat& format, CellGrid& grid) {
+    assert(values.size() == static_cast<std::size_t>(rows) * cols);
+    assert(format.color_codes.empty() ||
+           format.color_codes.size() == format.thresholds.size() + 1);
+    if (grid.rows() != rows || grid.cols() != cols) {
+        grid.resize(rows, cols);
+    }
+    constexpr std::size_t batch = 256;
+    int buckets[batch];
+    char digits[64];
+    wchar_t text[64];
+    for (std::size_t first = 0; first < values.size(); first += batch) {
+        const auto chunk =
+            values.subspan(first, std::min(batch, values.size() - first));
+        if (!format.color_codes.empty()) {
+            classify(chunk, std::span<const double>(format.thresholds),
+                     buckets);
+        }
+        for (std::size_t i = 0; i < chunk.size(); ++i) {
+            const auto end = digits + sizeof digits;
+            std::to_chars_result result;
+            if constexpr (std::is_floating_point_v<T>) {
+                result = std::to_chars(digits, end, chunk[i],
+                                       std::chars_format::fixed,
+                                       format.precision);
+                if (result.ec != std::errc()) {
+                    // Huge values have too many digits in fixed notation.
+                    result = std::to_chars(digits, end, chunk[i]);
+                }
+            } else {
+                result = std::to_chars(digits, end, chunk[i]);
+            }
+            const int length = result.ptr - digits;
+            std::copy(digits, digits + length, text);
+            const auto index = first + i;
+            grid.set(index / cols, index % cols,
+                     std::wstring_view(text, length),
+                     format.color_codes.empty()
+                         ? 0
+                         : format.color_codes[buckets[i]],
+                     length);
+        }
+    }
+}
+
 void n_chars(int n, auto c) {
-    std::wstring s(n, c);
-    addwstr(s.c_str());
+    // Write from a small stack buffer rather than building a string, so that
+    // padding never allocates.
+    constexpr int chunk_size = 64;
+    wchar_t chunk[chunk_size];
+    std::fill_n(chunk, std::min(n, chunk_size), c);
+    while (n > 0) {
+        const auto length = std::min(n, chunk_size);
+        addnwstr(chunk, length);
+        n -= length;
+    }
 }
 void addwch(const auto character) { n_chars(1, character); }
 void n_strings(int n, auto s) {
@@ -56,68 +767,570 @@ void n_strings(int n, auto s) {
 }
 
 void end_line() { addch('\n'); }
-auto positioned(const auto& content, auto width, int offset) {
-    if (content.length() >= width) {
-        return content;
-    } else {
-        auto left = std::wstring(offset, L' ');
-        auto right = std::wstring(width - (content.length() + offset), L' ');
-        auto line = left + content + right;
-        return line;
+// The alignment helpers below write content padded with blanks to width
+// terminal columns through the output iterator out, and return the iterator
+// past the last character written. Nothing is allocated. out can point into
+// a wchar_t buffer, or into a cchar_t one when glyph turns each character into
+// a cchar_t. Content wider than width is written whole, so out must have room
+// for it.
+
+// Core of the helpers, for callers that already know the display width of
+// content.
+template <class Out, class Glyph = std::identity>
+Out padded(std::wstring_view content, int content_width, int width,
+           int offset, Out out, Glyph glyph = {}) {
+    if (content_width >= width) {
+        return std::transform(content.begin(), content.end(), out, glyph);
     }
+    const auto blank = glyph(L' ');
+    out = std::fill_n(out, offset, blank);
+    out = std::transform(content.begin(), content.end(), out, glyph);
+    return std::fill_n(out, width - (content_width + offset), blank);
+}
+template <class Out, class Glyph = std::identity>
+Out positioned(std::wstring_view content, int width, int offset, Out out,
+               Glyph glyph = {}) {
+    return padded(content, display_width(content), width, offset, out, glyph);
+}
+template <class Out, class Glyph = std::identity>
+Out centered(std::wstring_view content, int width, Out out, Glyph glyph = {}) {
+    const auto content_width = display_width(content);
+    const auto offset = std::max(0, width - content_width) / 2;
+    return padded(content, content_width, width, offset, out, glyph);
+}
+template <class Out, class Glyph = std::identity>
+Out aligned_right(std::wstring_view content, int width, Out out,
+                  Glyph glyph = {}) {
+    const auto content_width = display_width(content);
+    const auto offset = std::max(0, width - content_width);
+    return padded(content, content_width, width, offset, out, glyph);
+}
+template <class Out, class Glyph = std::identity>
+Out aligned_left(std::wstring_view content, int width, Out out,
+                 Glyph glyph = {}) {
+    return positioned(content, width, 0, out, glyph);
+}
+
+auto positioned(const auto& content, auto width, int offset) {
+    const std::wstring_view view(content);
+    std::wstring line;
+    line.reserve(std::max<int>(width, view.length()));
+    positioned(view, width, offset, std::back_inserter(line));
+    return line;
 }
 auto centered(const auto& content, auto width) {
-    auto offset = (width - content.length()) / 2;
-    return positioned(content, width, offset);
+    std::wstring line;
+    line.reserve(std::max<int>(width, content.length()));
+    centered(content, width, std::back_inserter(line));
+    return line;
 }
 auto aligned_right(const auto& content, auto width) {
-    auto offset = width - content.length();
-    return positioned(content, width, offset);
+    std::wstring line;
+    line.reserve(std::max<int>(width, content.length()));
+    aligned_right(content, width, std::back_inserter(line));
+    return line;
 }
 auto aligned_left(const auto& content, auto width) {
     return positioned(content, width, 0);
 }
 enum class Aligned { right, left, center };
 
-void printline(const auto& content, int width = 0,
+// Writes the padding with repeated glyph writes around the content rather
+// than building the padded line.
+void printline(std::wstring_view content, int width = 0,
                Aligned alignment = Aligned::left) {
-    std::wstring s;
+    const int length = content.length();
+    const auto free = std::max(0, width - display_width(content));
+    int offset = 0;
     switch (alignment) {
         case Aligned::right: {
-            s = aligned_right(content, width);
-			break;
+            offset = free;
+            break;
         }
         case Aligned::left: {
-            s = aligned_left(content, width);
-			break;
+            offset = 0;
+            break;
         }
         case Aligned::center: {
-            s = centered(content, width);
-			break;
+            offset = free / 2;
+            break;
         }
     }
-    addwstr(s.c_str());
+    n_chars(offset, L' ');
+    if (length > 0) {
+        addnwstr(content.data(), length);
+    }
+    n_chars(free - offset, L' ');
 }
 
+// Durations counted in buckets whose bounds grow geometrically, four per
+// power of two, so that percentiles are known within 25% without keeping the
+// samples.
+class LatencyHistogram {
+   public:
+    using Duration = std::chrono::nanoseconds;
+
+    void record(Duration duration) {
+        ++buckets[bucket(std::max<Duration::rep>(0, duration.count()))];
+        ++samples;
+    }
+    long count() const { return samples; }
+    // Upper bound of the bucket holding the p-th quantile, p being in [0, 1].
+    Duration percentile(double p) const {
+        const auto rank = std::max<long>(1, p * samples + 0.5);
+        long seen = 0;
+        for (int i = 0; i < n_buckets; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return Duration(upper_bound(i));
+            }
+        }
+        return Duration(0);
+    }
+    Duration p50() const { return percentile(0.5); }
+    Duration p99() const { return percentile(0.99); }
+
+   private:
+    static constexpr int n_buckets = 64 * 4;
+    static int bucket(std::uint64_t nanoseconds) {
+        if (nanoseconds < 4) {
+            return nanoseconds;
+        }
+        const int exponent = std::bit_width(nanoseconds) - 1;
+        return exponent * 4 + (nanoseconds >> (exponent - 2) & 3);
+    }
+    static std::uint64_t upper_bound(int bucket) {
+        if (bucket < 4) {
+            return bucket;
+        }
+        const auto exponent = bucket / 4;
+        return (std::uint64_t{4} + bucket % 4 + 1) << (exponent - 2);
+    }
+
+    std::array<long, n_buckets> buckets{};
+    long samples = 0;
+};
+
+// What MatrixDisplay and Environment did since they were created or since
+// their statistics were reset, to be exported to metrics. They only record it,
+// and only have stats and reset_stats, when CURSED_ENABLE_STATS is defined.
+struct RenderStats {
+    // Frames printed by a display, or flushed by an environment.
+    long frames = 0;
+    // Cells formatted and written, and cells left alone by incremental
+    // prints because they didn't change.
+    long cells_drawn = 0;
+    long cells_skipped = 0;
+    // Writes to the backend, or refresh calls of an environment.
+    long calls = 0;
+    // Changes of attributes along the value lines.
+    long attribute_switches = 0;
+    // Characters written.
+    long glyphs = 0;
+    // Time spent in print, or in flush.
+    LatencyHistogram durations;
+};
+
+// Something that happened to an application: a key typed, a resize of the
+// terminal, a tick of the timer set with Environment::tick, or a call to
+// Environment::wake.
+struct Event {
+    enum class Type { key, resize, tick, wakeup };
+    Type type = Type::key;
+    // The character typed, or a KEY_ code when function_key is set.
+    wint_t key = 0;
+    bool function_key = false;
+};
+
+// A coroutine that starts right away, such as the main loop of an application
+// awaiting Environment::next_event. Its frame lives until the task is
+// destroyed, and its exceptions come out of the call that resumed it.
+class EventTask {
+   public:
+    struct promise_type {
+        EventTask get_return_object() {
+            return EventTask(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+    };
+    EventTask(EventTask&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {}
+    EventTask& operator=(EventTask&&) = delete;
+    ~EventTask() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+    bool done() const { return handle.done(); }
+
+   private:
+    explicit EventTask(std::coroutine_handle<promise_type> handle_)
+        : handle(handle_) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
 struct Environment {
+    using Clock = std::chrono::steady_clock;
+
     Environment() {
         initscr();
         setlocale(LC_ALL, "");
         cbreak();
         noecho();
         keypad(stdscr, true);
+        // With keypad, reading a lone Escape waits ESCDELAY, a second by
+        // default, for the rest of a sequence, which terminals send at once.
+        // A user's ESCDELAY is kept.
+        if (std::getenv("ESCDELAY") == nullptr) {
+            set_escdelay(25);
+        }
+        [[maybe_unused]] const auto piped = pipe(wake_pipe);
+        assert(piped == 0);
+        for (const auto descriptor : wake_pipe) {
+            fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+            fcntl(descriptor, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+    ~Environment() {
+        for (const auto& surface : surfaces) {
+            delwin(surface.window);
+        }
+        endwin();
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+    }
+    // Creates a window that lives as long as the environment and is refreshed
+    // by flush.
+    WINDOW* window(int lines, int cols, int y, int x) {
+        auto window = newwin(lines, cols, y, x);
+        surfaces.emplace_back(window);
+        return window;
+    }
+    // Creates a pad that lives as long as the environment. flush copies the
+    // part of it selected with show to the screen.
+    WINDOW* pad(int lines, int cols) {
+        auto pad = newpad(lines, cols);
+        surfaces.emplace_back(pad, true);
+        return pad;
+    }
+    // Shows the part of pad starting at (pad_y, pad_x) in the screen area of
+    // the given size whose top left corner is (y, x).
+    void show(WINDOW* pad, int pad_y, int pad_x, int y, int x, int lines,
+              int cols) {
+        for (auto& surface : surfaces) {
+            if (surface.window == pad) {
+                surface.viewport = {pad_y, pad_x, y, x, lines, cols};
+                surface.moved = true;
+            }
+        }
     }
-    ~Environment() { endwin(); }
+    // Ends a frame: copies stdscr and every window or pad changed since the
+    // previous frame to the virtual screen, then updates the terminal once.
+    void flush() {
+        CURSED_STATS(const auto start = std::chrono::steady_clock::now());
+        if (is_wintouched(stdscr)) {
+            wnoutrefresh(stdscr);
+            CURSED_STATS(++statistics.calls);
+        }
+        for (auto& surface : surfaces) {
+            if (!surface.is_pad) {
+                if (is_wintouched(surface.window)) {
+                    wnoutrefresh(surface.window);
+                    CURSED_STATS(++statistics.calls);
+                }
+                continue;
+            }
+            const auto view = on_screen(surface.viewport);
+            if (view.lines > 0 && view.cols > 0 &&
+                (surface.moved || is_wintouched(surface.window))) {
+                pnoutrefresh(surface.window, view.pad_y, view.pad_x, view.y,
+                             view.x, view.y + view.lines - 1,
+                             view.x + view.cols - 1);
+                CURSED_STATS(++statistics.calls);
+            }
+            surface.moved = false;
+        }
+        doupdate();
+        CURSED_STATS(++statistics.calls; ++statistics.frames;
+                     statistics.durations.record(
+                         std::chrono::steady_clock::now() - start));
+    }
+    // Waits for a key for at most timeout milliseconds, or for ever if it is
+    // negative, and returns ERR if none was typed. When the terminal was
+    // resized, ncurses has already resized stdscr and KEY_RESIZE is returned
+    // so that the application can lay itself out again.
+    int next_key(int timeout) {
+        wtimeout(stdscr, timeout);
+        const auto key = wgetch(stdscr);
+        if (key == KEY_RESIZE) {
+            resized();
+        }
+        return key;
+    }
+    // Sends a tick event every interval from now on, e.g. to drive
+    // animations, or none when interval is zero.
+    void tick(std::chrono::milliseconds interval) {
+        tick_interval = interval;
+        next_tick = Clock::now() + interval;
+    }
+    // Makes the environment return a wakeup event, e.g. when another thread
+    // has data to draw. It can be called from any thread, and the calls made
+    // before the event is returned are merged into it.
+    void wake() {
+        const char byte = 0;
+        [[maybe_unused]] const auto written = write(wake_pipe[1], &byte, 1);
+    }
+    // Sleeps in poll until something happens, on the terminal input, on the
+    // wakeup pipe or at the next tick, and returns it. A wakeup is returned
+    // without reading the terminal, so that drawing new data never waits for
+    // the keys, and the call after it looks at the keys first, so that
+    // frequent wakeups can't starve the input. Missed ticks are returned
+    // first for the same reason.
+    Event wait_event() {
+        for (;;) {
+            if (const auto event = ready_event()) {
+                return *event;
+            }
+            int timeout = -1;
+            if (tick_interval.count() > 0) {
+                timeout = std::chrono::ceil<std::chrono::milliseconds>(
+                              next_tick - Clock::now())
+                              .count();
+                timeout = std::max(timeout, 0);
+            }
+            pollfd descriptors[] = {{STDIN_FILENO, POLLIN, 0},
+                                    {wake_pipe[0], POLLIN, 0}};
+            // A resize interrupts poll, and ncurses then reports it as a key.
+            poll(descriptors, 2, timeout);
+        }
+    }
+    // Awaiting next_event from a coroutine suspends it until run resumes it
+    // with the next event, unless one is already there.
+    class EventAwaiter {
+       public:
+        explicit EventAwaiter(Environment& environment_)
+            : environment(environment_) {}
+        bool await_ready() {
+            const auto ready = environment.ready_event();
+            if (ready) {
+                event = *ready;
+            }
+            return ready.has_value();
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            assert(!environment.waiting);
+            environment.waiting = handle;
+            environment.waiting_event = &event;
+        }
+        Event await_resume() const { return event; }
+
+       private:
+        Environment& environment;
+        Event event;
+    };
+    EventAwaiter next_event() { return EventAwaiter(*this); }
+    // Waits for events and resumes the coroutine awaiting next_event with
+    // them, until none is waiting any more, e.g. because it returned.
+    void run() {
+        while (waiting) {
+            *waiting_event = wait_event();
+            std::exchange(waiting, nullptr).resume();
+        }
+    }
+#ifdef CURSED_ENABLE_STATS
+    // Frames flushed, refresh calls and the time spent in flush.
+    const RenderStats& stats() const { return statistics; }
+    void reset_stats() { statistics = {}; }
+#endif
+
+   private:
+    // The next event if one already happened, without waiting for it.
+    std::optional<Event> ready_event() {
+        const auto now = Clock::now();
+        if (tick_interval.count() > 0 && now >= next_tick) {
+            // Ticks missed while busy are merged rather than sent in a burst.
+            next_tick += tick_interval;
+            if (next_tick <= now) {
+                next_tick = now + tick_interval;
+            }
+            return Event{Event::Type::tick};
+        }
+        if (std::exchange(keys_first, false)) {
+            if (const auto key = typed_key()) {
+                return key;
+            }
+        }
+        char bytes[64];
+        auto woken = false;
+        while (read(wake_pipe[0], bytes, sizeof(bytes)) > 0) {
+            woken = true;
+        }
+        if (woken) {
+            keys_first = true;
+            return Event{Event::Type::wakeup};
+        }
+        return typed_key();
+    }
+    // The next key typed, if any, without waiting for it.
+    std::optional<Event> typed_key() {
+        wtimeout(stdscr, 0);
+        wint_t key = 0;
+        const auto status = wget_wch(stdscr, &key);
+        if (status == KEY_CODE_YES && key == KEY_RESIZE) {
+            resized();
+            return Event{Event::Type::resize, key, true};
+        }
+        if (status != ERR) {
+            return Event{Event::Type::key, key, status == KEY_CODE_YES};
+        }
+        return std::nullopt;
+    }
+
+    struct Viewport {
+        int pad_y = 0;
+        int pad_x = 0;
+        int y = 0;
+        int x = 0;
+        int lines = 0;
+        int cols = 0;
+    };
+    // The terminal was cleared, so the pads have to be copied again even if
+    // they didn't change.
+    void resized() {
+        for (auto& surface : surfaces) {
+            surface.moved = surface.is_pad;
+        }
+    }
+    // Cuts the part of a viewport that a smaller terminal no longer has.
+    static Viewport on_screen(Viewport view) {
+        view.lines = std::min(view.lines, LINES - view.y);
+        view.cols = std::min(view.cols, COLS - view.x);
+        return view;
+    }
+    struct Surface {
+        Surface(WINDOW* window_, bool is_pad_ = false)
+            : window(window_), is_pad{is_pad_} {}
+        WINDOW* window;
+        bool is_pad;
+        bool moved = false;
+        Viewport viewport;
+    };
+    std::vector<Surface> surfaces;
+#ifdef CURSED_ENABLE_STATS
+    RenderStats statistics;
+#endif
+    int wake_pipe[2] = {-1, -1};
+    std::chrono::milliseconds tick_interval{0};
+    Clock::time_point next_tick;
+    // Whether the keys get their turn before the wakeup pipe, after a
+    // wakeup.
+    bool keys_first = false;
+    // The coroutine suspended in next_event, and where its event goes.
+    std::coroutine_handle<> waiting;
+    Event* waiting_event = nullptr;
+};
+
+// The main loop of an application: it handles the keys as they are typed and
+// draws frames when they were asked for, but never more than fps times per
+// second, so that bursts of updates cost one frame per tick.
+class RenderScheduler {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    // Resizes are handled once the terminal size has been stable for
+    // resize_delay, so that dragging a window costs a single frame.
+    RenderScheduler(Environment& environment_, int fps,
+                    std::chrono::milliseconds resize_delay_ =
+                        std::chrono::milliseconds(100))
+        : environment(environment_),
+          interval(std::chrono::duration_cast<Clock::duration>(
+              std::chrono::seconds(1)) /
+                   fps),
+          resize_delay(resize_delay_) {
+        assert(fps > 0);
+    }
+    // Asks for a frame to be drawn at the next tick. Requests made before the
+    // frame is drawn are merged into it. It can be called from any thread.
+    void invalidate() { pending.store(true, std::memory_order_release); }
+    // Makes run return once the current key or frame is handled. It can be
+    // called from any thread.
+    void stop() { running.store(false, std::memory_order_release); }
+    // Calls on_key(key) for every key typed, and draw() followed by
+    // Environment::flush for every frame, until stop is called. The first
+    // frame is drawn right away. Between two ticks the loop sleeps in getch,
+    // and when no frame is pending it still wakes up once per tick to notice
+    // requests from other threads. A burst of resizes is handed to on_key as
+    // a single KEY_RESIZE, followed by a frame.
+    void run(auto draw, auto on_key) {
+        running.store(true, std::memory_order_release);
+        invalidate();
+        auto next_frame = Clock::now();
+        std::optional<Clock::time_point> resize_at;
+        while (running.load(std::memory_order_acquire)) {
+            auto now = Clock::now();
+            if (resize_at && now >= *resize_at) {
+                resize_at.reset();
+                on_key(KEY_RESIZE);
+                invalidate();
+            }
+            if (now >= next_frame &&
+                pending.exchange(false, std::memory_order_acq_rel)) {
+                draw();
+                environment.flush();
+                ++drawn;
+                now = Clock::now();
+                next_frame = now + interval;
+            }
+            auto timeout = pending.load(std::memory_order_acquire)
+                               ? next_frame - now
+                               : interval;
+            if (resize_at) {
+                timeout = std::min(timeout, *resize_at - now);
+            }
+            const auto key = next_key(timeout);
+            if (key == KEY_RESIZE) {
+                resize_at = Clock::now() + resize_delay;
+            } else if (key != ERR) {
+                on_key(key);
+            }
+        }
+    }
+    // Frames drawn since the scheduler was created.
+    long frames() const { return drawn; }
+
+   private:
+    // Waits for a key for at most timeout, rounded up to the millisecond.
+    int next_key(Clock::duration timeout) {
+        const auto milliseconds =
+            std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+        return environment.next_key(std::max<long>(0, milliseconds));
+    }
+
+    Environment& environment;
+    const Clock::duration interval;
+    const Clock::duration resize_delay;
+    std::atomic<bool> pending{false};
+    std::atomic<bool> running{false};
+    long drawn = 0;
 };
 
 struct BoxStyle {
     struct Corners {
+        bool operator==(const Corners&) const = default;
         wchar_t top_left = L'┏';
         wchar_t top_right = L'┓';
         wchar_t bottom_left = L'┗';
         wchar_t bottom_right = L'┛';
     };
     struct Intersections {
+        bool operator==(const Intersections&) const = default;
         wchar_t top = L'┳';
         wchar_t bottom = L'┻';
         wchar_t left = L'┣';
@@ -125,9 +1338,11 @@ struct BoxStyle {
         wchar_t center = L'╋';
     };
     struct Borders {
+        bool operator==(const Borders&) const = default;
         wchar_t horizontal = L'━';
         wchar_t vertical = L'┃';
     };
+    bool operator==(const BoxStyle&) const = default;
     Corners corners;
     Intersections intersections;
     Borders borders;
@@ -141,91 +1356,1301 @@ struct MatrixStyle {
     BoxStyle box_style;
 };
 
+struct CellPosition {
+    bool operator==(const CellPosition&) const = default;
+    int row = 0;
+    int col = 0;
+};
+
+// The size of a rows by cols matrix drawn with a style, borders included,
+// and where its cells are relative to its top left corner. It is computed
+// once, so that every query is a few integer operations.
+class MatrixGeometry {
+   public:
+    MatrixGeometry() = default;
+    MatrixGeometry(int rows_, int cols_, int cell_width_, int cell_height_)
+        : n_rows(rows_),
+          n_cols(cols_),
+          line_stride(cell_height_ + 1),
+          col_stride(cell_width_ + 1),
+          n_lines(rows_ * line_stride + 1),
+          n_chars(cols_ * col_stride + 1) {
+        assert(rows_ >= 0 && cols_ >= 0 && cell_width_ > 0 &&
+               cell_height_ > 0);
+    }
+    MatrixGeometry(int rows_, int cols_, const MatrixStyle& style)
+        : MatrixGeometry(rows_, cols_, style.cell_width, style.cell_height) {}
+    int rows() const { return n_rows; }
+    int cols() const { return n_cols; }
+    int width() const { return n_chars; }
+    int height() const { return n_lines; }
+    // The top left character inside a cell.
+    int cell_y(int row) const { return 1 + row * line_stride; }
+    int cell_x(int col) const { return 1 + col * col_stride; }
+    // The cell a character is inside of, if it is neither on a border nor
+    // outside of the matrix.
+    std::optional<CellPosition> cell_at(int y, int x) const {
+        if (y <= 0 || x <= 0 || y >= n_lines - 1 || x >= n_chars - 1 ||
+            y % line_stride == 0 || x % col_stride == 0) {
+            return std::nullopt;
+        }
+        return CellPosition{y / line_stride, x / col_stride};
+    }
+
+   private:
+    int n_rows = 0;
+    int n_cols = 0;
+    int line_stride = 2;
+    int col_stride = 2;
+    int n_lines = 1;
+    int n_chars = 1;
+};
+
+// A glyph with its attributes. There are no negative color pairs, so the
+// negative color codes callers may use draw in the default colors, pair 0.
+inline cchar_t wide_char(wchar_t glyph, attr_t attributes = A_NORMAL,
+                         short pair = 0) {
+    const wchar_t text[] = {glyph, L'\0'};
+    cchar_t character{};
+    if (setcchar(&character, text, attributes, std::max<short>(pair, 0),
+                 nullptr) == ERR) {
+        // Still a glyph, without colors, rather than an undefined cchar_t.
+        character = {};
+        character.attr = attributes;
+        character.chars[0] = glyph;
+    }
+    return character;
+}
+
+// Attributes of the current run of same colored cells. They are resolved
+// only when the color code changes, so a whole run of cells shares a single
+// setcchar call instead of one per character.
+class AttributeState {
+   public:
+    // Returns whether the attributes changed.
+    bool update(int color_code_) {
+        if (color_code_ == color_code) {
+            return false;
+        }
+        color_code = color_code_;
+        blank_ = wide_char(L' ', A_BOLD, color_code_);
+        return true;
+    }
+    const cchar_t& blank() const { return blank_; }
+    cchar_t glyph(wchar_t character) const {
+        auto glyph = blank_;
+        glyph.chars[0] = character;
+        return glyph;
+    }
+
+   private:
+    // Empty until the first update, as any int is a valid color code.
+    std::optional<int> color_code;
+    cchar_t blank_ = wide_char(L' ', A_BOLD);
+};
+
+// The lines of a matrix that don't depend on the cell contents: the top,
+// middle and bottom separators and a blank padding line. They are built once
+// for a column count and a style, so that each of them can be written with a
+// single add_wchnstr call.
+struct LineCache {
+    // Rebuilds the lines when the column count or the style changed.
+    void update(int n_, const MatrixStyle& style) {
+        if (n_ == n && style.cell_width == cell_width &&
+            style.box_style == box_style) {
+            return;
+        }
+        n = n_;
+        cell_width = style.cell_width;
+        box_style = style.box_style;
+        const auto& box = box_style;
+        build(top, box.corners.top_left, box.borders.horizontal,
+              box.intersections.top, box.corners.top_right, A_BOLD);
+        build(middle, box.intersections.left, box.borders.horizontal,
+              box.intersections.center, box.intersections.right, A_BOLD);
+        build(bottom, box.corners.bottom_left, box.borders.horizontal,
+              box.intersections.bottom, box.corners.bottom_right, A_BOLD);
+        build(padding, box.borders.vertical, L' ', box.borders.vertical,
+              box.borders.vertical, A_BOLD);
+    }
+    // Gives the blank of cell c of a copy of the padding line the color of
+    // the cell, as the padding lines of a row take its colors.
+    void color_padding(std::vector<cchar_t>& line, int c,
+                       const AttributeState& attributes) const {
+        std::fill_n(line.begin() + 1 + c * (cell_width + 1), cell_width,
+                    attributes.blank());
+    }
+
+    std::vector<cchar_t> top;
+    std::vector<cchar_t> middle;
+    std::vector<cchar_t> bottom;
+    std::vector<cchar_t> padding;
+
+   private:
+    // The glyphs between the junctions carry the attributes a cell would.
+    void build(std::vector<cchar_t>& line, wchar_t left, wchar_t plain,
+               wchar_t intersection, wchar_t right, attr_t plain_attributes) {
+        line.clear();
+        line.push_back(wide_char(left));
+        for (int c = 0; c < n; ++c) {
+            if (c != 0) {
+                line.push_back(wide_char(intersection));
+            }
+            line.insert(line.end(), cell_width,
+                        wide_char(plain, plain_attributes));
+        }
+        line.push_back(wide_char(right));
+    }
+
+    int n = -1;
+    int cell_width = -1;
+    BoxStyle box_style;
+};
+
+// Where MatrixDisplay draws. A backend writes runs of characters at a
+// position, places the cursor once a matrix is drawn and knows its size.
+// surface identifies what is drawn on, so that incremental prints can tell
+// whether they draw over their previous frame.
+template <class T>
+concept RenderBackend = requires(T& backend, const T& const_backend, int y,
+                                 int x, const cchar_t* characters, int n) {
+    backend.put(y, x, characters, n);
+    backend.move(y, x);
+    { const_backend.lines() } -> std::convertible_to<int>;
+    { const_backend.cols() } -> std::convertible_to<int>;
+    { const_backend.surface() } -> std::convertible_to<const void*>;
+};
+
+// A backend that can also scroll its whole content up by n lines, blanking
+// the lines uncovered at the bottom, for tables that grow at the bottom.
+template <class T>
+concept ScrollingBackend =
+    RenderBackend<T> && requires(T& backend, int n) { backend.scroll_up(n); };
+
+// Draws in an ncurses window or pad. It is only a pointer, so it costs
+// nothing to create one per print.
+class NcursesBackend {
+   public:
+    explicit NcursesBackend(WINDOW* window_) : window(window_) {}
+    // Writes n characters, which may stop early at a null character, without
+    // moving the cursor.
+    void put(int y, int x, const cchar_t* characters, int n) {
+        mvwadd_wchnstr(window, y, x, characters, n);
+    }
+    void move(int y, int x) { wmove(window, y, x); }
+    // Lets ncurses use the insert and delete line capabilities of the
+    // terminal, so that only the lines uncovered are sent to it.
+    void scroll_up(int n) {
+        scrollok(window, true);
+        idlok(window, true);
+        wscrl(window, n);
+    }
+    int lines() const { return getmaxy(window); }
+    int cols() const { return getmaxx(window); }
+    const void* surface() const { return window; }
+
+   private:
+    WINDOW* window;
+};
+
+// A framebuffer in memory, which needs neither a terminal nor an ncurses
+// screen: for snapshots of what a display shows, or for comparing the output
+// of two ways of drawing it.
+class MemoryBackend {
+   public:
+    // What a column of the framebuffer shows. A glyph wider than a column is
+    // stored in its first column, and the columns it covers hold a glyph of 0.
+    // The characters combined with the glyph follow it in combining, ended by
+    // a 0 unless they fill it.
+    struct Character {
+        bool operator==(const Character&) const = default;
+        char32_t glyph = U' ';
+        std::array<char32_t, CCHARW_MAX - 1> combining = {};
+        attr_t attributes = A_NORMAL;
+        short pair = 0;
+    };
+    MemoryBackend(int lines_, int cols_)
+        : n_lines(lines_), n_cols(cols_), characters(lines_ * cols_) {
+        assert(lines_ >= 0 && cols_ >= 0);
+    }
+    bool operator==(const MemoryBackend&) const = default;
+    // Same as NcursesBackend::put: the characters that don't fit on the line
+    // are dropped.
+    void put(int y, int x, const cchar_t* text, int n) {
+        if (y < 0 || y >= n_lines) {
+            return;
+        }
+        for (int i = 0; i < n && x < n_cols; ++i) {
+            wchar_t glyph[CCHARW_MAX + 1];
+            attr_t attributes;
+            short pair;
+            getcchar(&text[i], glyph, &attributes, &pair, nullptr);
+            if (glyph[0] == L'\0') {
+                break;
+            }
+            const auto width =
+                glyph[0] < 0x7f ? 1 : std::max(1, wcwidth(glyph[0]));
+            if (x >= 0) {
+                auto& character = at(y, x);
+                character = {static_cast<char32_t>(glyph[0]), {},
+                             attributes & ~A_COLOR, pair};
+                for (int i = 1; i < CCHARW_MAX && glyph[i] != L'\0'; ++i) {
+                    character.combining[i - 1] = glyph[i];
+                }
+            }
+            for (int covered = x + 1; covered < x + width && covered < n_cols;
+                 ++covered) {
+                if (covered >= 0) {
+                    at(y, covered) = {0, {}, attributes & ~A_COLOR, pair};
+                }
+            }
+            x += width;
+        }
+    }
+    void move(int y, int x) {
+        cursor_y = y;
+        cursor_x = x;
+    }
+    void scroll_up(int n) {
+        n = std::clamp(n, 0, n_lines);
+        std::copy(characters.begin() + n * n_cols, characters.end(),
+                  characters.begin());
+        std::fill(characters.end() - n * n_cols, characters.end(),
+                  Character{});
+    }
+    int lines() const { return n_lines; }
+    int cols() const { return n_cols; }
+    const void* surface() const { return this; }
+
+    const Character& operator()(int y, int x) const {
+        assert(y >= 0 && y < n_lines && x >= 0 && x < n_cols);
+        return characters[y * n_cols + x];
+    }
+    // Where the cursor was last moved to.
+    int cursor_line() const { return cursor_y; }
+    int cursor_col() const { return cursor_x; }
+    // Blanks the whole framebuffer.
+    void clear() {
+        std::fill(characters.begin(), characters.end(), Character{});
+    }
+    // Changes the size of the framebuffer the way a terminal resize would:
+    // what fits in both sizes is kept, the rest is blank, and it stays the
+    // same surface.
+    void resize(int lines_, int cols_) {
+        assert(lines_ >= 0 && cols_ >= 0);
+        std::vector<Character> resized(lines_ * cols_);
+        for (int y = 0; y < std::min(lines_, n_lines); ++y) {
+            std::copy_n(characters.begin() + y * n_cols,
+                        std::min(cols_, n_cols),
+                        resized.begin() + y * cols_);
+        }
+        characters = std::move(resized);
+        n_lines = lines_;
+        n_cols = cols_;
+    }
+    // The glyphs of line y and the characters combined with them, without the
+    // columns covered by wide glyphs nor the blanks at the end of the line.
+    std::u32string line(int y) const {
+        std::u32string text;
+        for (int x = 0; x < n_cols; ++x) {
+            const auto& character = (*this)(y, x);
+            if (character.glyph == 0) {
+                continue;
+            }
+            text.push_back(character.glyph);
+            for (const auto combining : character.combining) {
+                if (combining == 0) {
+                    break;
+                }
+                text.push_back(combining);
+            }
+        }
+        text.erase(text.find_last_not_of(U' ') + 1);
+        return text;
+    }
+    // The text of every line, encoded in UTF-8 and ended by a newline.
+    std::string snapshot() const {
+        std::string text;
+        for (int y = 0; y < n_lines; ++y) {
+            for (const auto glyph : line(y)) {
+                append_utf8(glyph, text);
+            }
+            text.push_back('\n');
+        }
+        return text;
+    }
+
+   private:
+    Character& at(int y, int x) { return characters[y * n_cols + x]; }
+
+    int n_lines;
+    int n_cols;
+    std::vector<Character> characters;
+    int cursor_y = 0;
+    int cursor_x = 0;
+};
+
+// How MatrixDisplay::print refreshes the screen.
+// full: every call draws the borders and all the cells.
+// incremental: the first call draws everything, later calls only rewrite the
+// cells whose content or color changed since the previous call. Borders are
+// redrawn when the shape of the data or the size of the terminal changes.
+enum class Redraw { full, incremental };
+
+// Anything that gives the cell at (row, col), such as a CellGrid or a
+// function formatting the cells of a table on demand. The content of the
+// returned view only has to stay valid until the provider is called again,
+// as providers other than CellGrid and LabelGrid are only called by the
+// thread that prints.
+template <class T>
+concept CellProvider = requires(const T& cells, int row, int col) {
+    { cells(row, col) } -> std::convertible_to<CellView>;
+};
+
+// A block of cells: the rows [first_row, first_row + rows) and the columns
+// [first_col, first_col + cols) of a grid.
+struct CellRange {
+    bool operator==(const CellRange&) const = default;
+    int first_row = 0;
+    int first_col = 0;
+    int rows = 0;
+    int cols = 0;
+};
+
+// A fixed set of threads running the tasks of one job at a time, so that
+// starting a job costs neither a thread creation nor an allocation.
+class WorkerPool {
+   public:
+    explicit WorkerPool(int threads) {
+        assert(threads > 0);
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back([this](std::stop_token stop) { work(stop); });
+        }
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    int size() const { return workers.size(); }
+    // Starts calling task(i) for every i in [0, tasks) from the workers. The
+    // task must live until wait returns.
+    template <class Task>
+    void start(int tasks, Task& task_) {
+        std::lock_guard lock(mutex);
+        assert(remaining == 0);
+        task = &task_;
+        run = [](void* erased, int i) { (*static_cast<Task*>(erased))(i); };
+        next = 0;
+        count = tasks;
+        remaining = tasks;
+        ready.notify_all();
+    }
+    // Waits until every task of the last job started is done.
+    void wait() {
+        std::unique_lock lock(mutex);
+        done.wait(lock, [&] { return remaining == 0; });
+    }
+
+   private:
+    void work(std::stop_token stop) {
+        std::unique_lock lock(mutex);
+        while (ready.wait(lock, stop, [&] { return next < count; })) {
+            const auto i = next++;
+            lock.unlock();
+            run(task, i);
+            lock.lock();
+            if (--remaining == 0) {
+                done.notify_all();
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable_any ready;
+    std::condition_variable done;
+    void* task = nullptr;
+    void (*run)(void*, int) = nullptr;
+    int next = 0;
+    int count = 0;
+    int remaining = 0;
+    // Last, so that the threads are stopped before the rest is destroyed.
+    std::vector<std::jthread> workers;
+};
+
 class MatrixDisplay {
    public:
-    MatrixDisplay(const MatrixStyle& style_) : style(style_) {}
-    int width_in_chars(const std::vector<std::vector<Cell>>& data) {
-        return (style.cell_width + 1) * n_rows(data);
+    // With more than one thread, the rows of large CellGrids and LabelGrids
+    // are formatted by that many threads while the calling thread writes the
+    // finished ones, so their cells may be read from several threads at
+    // once. Other providers are always formatted by the calling thread.
+    MatrixDisplay(const MatrixStyle& style_, Redraw redraw_ = Redraw::full,
+                  int threads = 1)
+        : style(style_),
+          redraw(redraw_),
+          workers(threads > 1 ? std::make_unique<WorkerPool>(threads)
+                              : nullptr) {}
+    // The size of a rows by cols matrix and where its cells are.
+    MatrixGeometry geometry(int rows, int cols) const {
+        return {rows, cols, style};
+    }
+    // Characters taken by a matrix, borders included.
+    int width_in_chars(const CellGrid& grid) const {
+        return geometry(grid.rows(), grid.cols()).width();
+    }
+    int width_in_chars(const std::vector<std::vector<Cell>>& data) const {
+        return geometry(data.size(), n_cols(data)).width();
+    }
+    int height_in_chars(const CellGrid& grid) const {
+        return geometry(grid.rows(), grid.cols()).height();
+    }
+    int height_in_chars(const std::vector<std::vector<Cell>>& data) const {
+        return geometry(data.size(), n_cols(data)).height();
+    }
+    // The part of the matrix drawn by the last print, relative to where it
+    // was drawn.
+    const MatrixGeometry& geometry() const { return placed; }
+    // The cell of the matrix under the character (y, x) of the target of
+    // the last print, if any.
+    std::optional<CellPosition> cell_at(int y, int x) const {
+        auto cell = placed.cell_at(y - origin_y, x - origin_x);
+        if (cell) {
+            cell->row += shown.first_row;
+            cell->col += shown.first_col;
+        }
+        return cell;
+    }
+    // Draws the matrix on stdscr with its top left corner at the cursor, and
+    // leaves the cursor on the line below it. In incremental mode, the matrix
+    // stays where it was first drawn until invalidate is called.
+    void print(const CellGrid& grid) {
+        print(grid, 0, 0, grid.rows(), grid.cols());
     }
     void print(const std::vector<std::vector<Cell>>& data) {
-        int n = n_rows(data);
-        top_row(n);
-        auto first = true;
-        for (const auto& row : data) {
-            if (first) {
-                first = false;
-            } else {
-                middle_row(n);
+        staging.assign(data);
+        print(staging);
+    }
+    // Draws a rows by cols matrix of numbers stored row after row, such as a
+    // std::vector<double>, formatted and colored according to format.
+    template <std::ranges::contiguous_range Values>
+        requires Number<std::ranges::range_value_t<Values>>
+    void print(const Values& values, int rows, int cols,
+               const NumericFormat& format) {
+        format_numbers(std::span(std::ranges::data(values),
+                                 std::ranges::size(values)),
+                       rows, cols, format, staging);
+        print(staging);
+    }
+    template <RenderBackend Target, std::ranges::contiguous_range Values>
+        requires Number<std::ranges::range_value_t<Values>>
+    void print(Target& target, int y, int x, const Values& values, int rows,
+               int cols, const NumericFormat& format) {
+        format_numbers(std::span(std::ranges::data(values),
+                                 std::ranges::size(values)),
+                       rows, cols, format, staging);
+        print(target, y, x, staging);
+    }
+    // Takes a frame over without copying it, to be drawn by the print
+    // overloads that are given no cells.
+    void set_data(CellGrid&& grid) { owned = std::move(grid); }
+    // Exchanges the frame of the display with grid, which gets the previous
+    // one back, e.g. to fill it with the next frame.
+    void swap_data(CellGrid& grid) { std::swap(owned, grid); }
+    const CellGrid& data() const { return owned; }
+    // Replays a delta on the frame of the display, and returns false when it
+    // doesn't apply to a frame of that shape. The next print draws the
+    // result; in incremental mode, only the changed cells are rewritten.
+    bool apply(const FrameDelta& delta) {
+        if (delta.full()) {
+            owned.resize(delta.rows(), delta.cols());
+        } else if (delta.rows() != owned.rows() ||
+                   delta.cols() != owned.cols()) {
+            return false;
+        }
+        std::size_t i = 0;
+        for (const auto& run : delta.runs()) {
+            for (int k = 0; k < run.length; ++k) {
+                owned.set(run.row, run.first_col + k, delta.text(i++),
+                          run.color_code);
             }
-            values(row);
         }
-        bottom_row(n);
+        return true;
+    }
+    void print() { print(owned); }
+    void print(WINDOW* window, int y, int x) { print(window, y, x, owned); }
+    template <RenderBackend Target>
+    void print(Target& target, int y, int x) {
+        print(target, y, x, owned);
+    }
+    // Draws the block of visible_rows by visible_cols cells of grid starting
+    // at (first_row, first_col) as a matrix of its own. Only the cells inside
+    // the grid that intersect the window are formatted, so the cost depends on
+    // the size of the screen rather than on the size of the grid.
+    void print(const CellGrid& grid, int first_row, int first_col,
+               int visible_rows, int visible_cols) {
+        print(grid.rows(), grid.cols(), grid, first_row, first_col,
+              visible_rows, visible_cols);
+    }
+    // Draws a rows by cols matrix whose cells are pulled from cells as they
+    // are drawn, so they never have to be stored as a whole.
+    template <CellProvider Cells>
+    void print(int rows, int cols, const Cells& cells) {
+        print(rows, cols, cells, 0, 0, rows, cols);
+    }
+    template <CellProvider Cells>
+    void print(int rows, int cols, const Cells& cells, int first_row,
+               int first_col, int visible_rows, int visible_cols) {
+        int y, x;
+        getyx(stdscr, y, x);
+        if (redraw == Redraw::incremental && surface == stdscr &&
+            !previous.empty()) {
+            y = origin_y;
+            x = origin_x;
+        }
+        NcursesBackend target(stdscr);
+        render(target, y, x, rows, cols, cells,
+               {first_row, first_col, visible_rows, visible_cols});
+    }
+    // Draws the latest frame published to frames, and returns false without
+    // drawing anything when there is no new one since the previous call.
+    bool print(FrameBuffer& frames) {
+        if (!frames.acquire()) {
+            return false;
+        }
+        print(frames.front());
+        return true;
+    }
+    // Draws the matrix in a window or a pad, with its top left corner at
+    // (y, x). Nothing is refreshed: see Environment::flush.
+    void print(WINDOW* window, int y, int x, const CellGrid& grid) {
+        NcursesBackend target(window);
+        print(target, y, x, grid);
+    }
+    void print(WINDOW* window, int y, int x,
+               const std::vector<std::vector<Cell>>& data) {
+        NcursesBackend target(window);
+        print(target, y, x, data);
+    }
+    void print(WINDOW* window, int y, int x, const CellGrid& grid,
+               int first_row, int first_col, int visible_rows,
+               int visible_cols) {
+        NcursesBackend target(window);
+        print(target, y, x, grid, first_row, first_col, visible_rows,
+              visible_cols);
+    }
+    template <CellProvider Cells>
+    void print(WINDOW* window, int y, int x, int rows, int cols,
+               const Cells& cells) {
+        NcursesBackend target(window);
+        print(target, y, x, rows, cols, cells);
+    }
+    template <CellProvider Cells>
+    void print(WINDOW* window, int y, int x, int rows, int cols,
+               const Cells& cells, int first_row, int first_col,
+               int visible_rows, int visible_cols) {
+        NcursesBackend target(window);
+        print(target, y, x, rows, cols, cells, first_row, first_col,
+              visible_rows, visible_cols);
+    }
+    // Draws the matrix through any backend, such as a MemoryBackend, with its
+    // top left corner at (y, x).
+    template <RenderBackend Target>
+    void print(Target& target, int y, int x, const CellGrid& grid) {
+        print(target, y, x, grid, 0, 0, grid.rows(), grid.cols());
+    }
+    template <RenderBackend Target>
+    void print(Target& target, int y, int x,
+               const std::vector<std::vector<Cell>>& data) {
+        staging.assign(data);
+        print(target, y, x, staging);
+    }
+    template <RenderBackend Target>
+    void print(Target& target, int y, int x, const CellGrid& grid,
+               int first_row, int first_col, int visible_rows,
+               int visible_cols) {
+        print(target, y, x, grid.rows(), grid.cols(), grid, first_row,
+              first_col, visible_rows, visible_cols);
+    }
+    template <RenderBackend Target>
+    bool print(Target& target, int y, int x, FrameBuffer& frames) {
+        if (!frames.acquire()) {
+            return false;
+        }
+        print(target, y, x, frames.front());
+        return true;
+    }
+    template <RenderBackend Target, CellProvider Cells>
+    void print(Target& target, int y, int x, int rows, int cols,
+               const Cells& cells) {
+        print(target, y, x, rows, cols, cells, 0, 0, rows, cols);
+    }
+    template <RenderBackend Target, CellProvider Cells>
+    void print(Target& target, int y, int x, int rows, int cols,
+               const Cells& cells, int first_row, int first_col,
+               int visible_rows, int visible_cols) {
+        render(target, y, x, rows, cols, cells,
+               {first_row, first_col, visible_rows, visible_cols});
+    }
+    // Makes the next incremental print redraw everything, e.g. after the
+    // screen was cleared.
+    void invalidate() {
+        previous.resize(0, 0);
+        invalidated.clear();
+        streamed_rows = 0;
+    }
+#ifdef CURSED_ENABLE_STATS
+    // What the display drew since it was created or since reset_stats.
+    const RenderStats& stats() const { return statistics; }
+    void reset_stats() { statistics = {}; }
+#endif
+    // Streaming: appends a row of cols cells at the bottom of a matrix drawn
+    // from the top left corner of target. Once the target is full, it is
+    // scrolled up to make room, so that an appended row only costs its own
+    // cells, one separator line and the bottom border, whatever the number
+    // of rows above it. The first call, or the first call after invalidate or
+    // with another target or column count, starts a new matrix. A display is
+    // meant to be used either for prints or for appends.
+    template <ScrollingBackend Target, CellProvider Cells>
+    void append(Target& target, int cols, const Cells& cells, int row) {
+        assert(cols > 0);
+        assert(target.lines() >= height_in_lines(1));
+        CURSED_STATS(const auto start = std::chrono::steady_clock::now());
+        if (streamed_rows == 0 || target.surface() != surface ||
+            cols != shown.cols) {
+            surface = target.surface();
+            origin_y = 0;
+            origin_x = 0;
+            shown = {0, 0, 0, cols};
+            placed = geometry(0, cols);
+            previous.resize(0, 0);
+            streamed_rows = 0;
+            lines.update(cols, style);
+            line(target, 0, lines.top);
+        }
+        // origin_y tracks the line of the bottom border, which is where the
+        // top border of a matrix made of the new row alone would be.
+        const auto overflow =
+            origin_y + height_in_lines(1) - target.lines();
+        if (overflow > 0) {
+            target.scroll_up(overflow);
+            origin_y -= overflow;
+        }
+        if (streamed_rows != 0) {
+            line(target, origin_y, lines.middle);
+        }
+        values(target, cells, CellRange{row, 0, 1, cols}, 0);
+        origin_y += style.cell_height + 1;
+        line(target, origin_y, lines.bottom);
+        ++streamed_rows;
+        CURSED_STATS(statistics.cells_drawn += cols; record_frame(start));
+    }
+    template <ScrollingBackend Target>
+    void append(Target& target, const std::vector<Cell>& row) {
+        append(target, row.size(), [&](int, int col) {
+            return CellView{row[col].content, row[col].color_code};
+        }, 0);
+    }
+    template <CellProvider Cells>
+    void append(WINDOW* window, int cols, const Cells& cells, int row) {
+        NcursesBackend target(window);
+        append(target, cols, cells, row);
+    }
+    void append(WINDOW* window, const std::vector<Cell>& row) {
+        NcursesBackend target(window);
+        append(target, row);
+    }
+    // Make the next incremental print rewrite a row or a cell of the matrix,
+    // given in the coordinates of the whole matrix, even when they didn't
+    // change. Full prints redraw everything anyway.
+    void invalidate_row(int row) {
+        for (int c = 0; c < shown.cols; ++c) {
+            invalidate_cell(row, shown.first_col + c);
+        }
+    }
+    void invalidate_cell(int row, int col) {
+        const auto r = row - shown.first_row;
+        const auto c = col - shown.first_col;
+        if (previous.empty() || !is_shown(r, c)) {
+            return;
+        }
+        // Past one entry per cell, redrawing everything costs less.
+        if (invalidated.size() >=
+            static_cast<std::size_t>(previous.rows()) * previous.cols()) {
+            previous.resize(0, 0);
+            return;
+        }
+        invalidated.push_back({r, c});
+    }
+    // Rewrites a cell of the matrix drawn last with a new content and color,
+    // padding lines included, without touching the borders or any other
+    // cell. Cells outside of the part of the matrix that is shown are
+    // ignored.
+    void update_cell(int row, int col, std::wstring_view content,
+                     int color_code = 0) {
+        NcursesBackend target(stdscr);
+        update_cell(target, row, col, content, color_code);
+    }
+    void update_cell(WINDOW* window, int row, int col,
+                     std::wstring_view content, int color_code = 0) {
+        NcursesBackend target(window);
+        update_cell(target, row, col, content, color_code);
+    }
+    template <RenderBackend Target>
+    void update_cell(Target& target, int row, int col,
+                     std::wstring_view content, int color_code = 0) {
+        assert(target.surface() == surface);
+        const auto r = row - shown.first_row;
+        const auto c = col - shown.first_col;
+        if (!is_shown(r, c)) {
+            return;
+        }
+        const CellView view{content, color_code};
+        cell(target, r, c, view);
+        if (!previous.empty()) {
+            previous.set(r, c, view);
+        }
     }
 
    private:
-    int n_rows(const std::vector<std::vector<Cell>>& data) {
-        assert(!data.empty());
-        return data[0].size();
+    template <class Target, class Cells>
+    void render(Target& target, int y, int x, int rows, int cols,
+                const Cells& cells, CellRange requested) {
+        assert(rows > 0 && cols > 0);
+        const auto range = visible(target, y, x, rows, cols, requested);
+        if (range.rows == 0 || range.cols == 0) {
+            // A target too small for a single cell may have lost what was
+            // drawn on it.
+            previous.resize(0, 0);
+            return;
+        }
+        CURSED_STATS(const auto start = std::chrono::steady_clock::now());
+        shown = range;
+        placed = geometry(range.rows, range.cols);
+        const auto in_place = redraw == Redraw::incremental &&
+                              target.surface() == surface && y == origin_y &&
+                              x == origin_x && !previous.empty();
+        if (in_place && can_update(target, range)) {
+            update(target, cells, range);
+        } else if (in_place && resized(target)) {
+            reflow(target, cells, range);
+        } else {
+            draw(target, y, x, cells, range);
+            CURSED_STATS(statistics.cells_drawn +=
+                         static_cast<long>(range.rows) * range.cols);
+        }
+        CURSED_STATS(record_frame(start));
     }
-    void value_row(std::vector<Cell> row, auto left, auto intersection,
-                   auto right) {
-        addwch(left);
-        auto first = true;
-        for (const auto& cell : row) {
-            if (first) {
-                first = false;
-            } else {
-                addwch(intersection);
+#ifdef CURSED_ENABLE_STATS
+    void record_frame(std::chrono::steady_clock::time_point start) {
+        ++statistics.frames;
+        statistics.durations.record(std::chrono::steady_clock::now() - start);
+    }
+#endif
+    // Every write to the target goes through here.
+    template <class Target>
+    void put(Target& target, int y, int x, const cchar_t* characters,
+             std::size_t n) {
+        target.put(y, x, characters, n);
+        CURSED_STATS(++statistics.calls; statistics.glyphs += n);
+    }
+    // Restricts range to the cells of a rows by cols matrix that intersect
+    // the target when the matrix is drawn at (y, x).
+    template <class Target>
+    CellRange visible(const Target& target, int y, int x, int rows, int cols,
+                      CellRange range) const {
+        const int lines = target.lines();
+        const int target_cols = target.cols();
+        range.first_row = std::clamp(range.first_row, 0, rows);
+        range.first_col = std::clamp(range.first_col, 0, cols);
+        range.rows = std::clamp(
+            range.rows, 0,
+            std::min(rows - range.first_row,
+                     fitting(lines - y, style.cell_height)));
+        range.cols = std::clamp(
+            range.cols, 0,
+            std::min(cols - range.first_col,
+                     fitting(target_cols - x, style.cell_width)));
+        return range;
+    }
+    // Number of cells of the given size whose inside starts within the
+    // available characters, the first one being taken by a border.
+    static int fitting(int available, int cell_size) {
+        return std::max(0, (available - 1 + cell_size) / (cell_size + 1));
+    }
+    template <class Cells>
+    static CellView at(const Cells& cells, const CellRange& range, int r,
+                       int c) {
+        return cells(range.first_row + r, range.first_col + c);
+    }
+    // Whether the workers format the rows. The views of grids point into
+    // them, so they stay valid as other cells are read, while a provider may
+    // format every cell into the same buffer.
+    template <class Cells>
+    bool in_parallel(const CellRange& range) const {
+        return (std::same_as<Cells, CellGrid> ||
+                std::same_as<Cells, LabelGrid>) &&
+               workers && range.rows * range.cols >= parallel_cells;
+    }
+    template <class Target, class Cells>
+    void draw(Target& target, int y, int x, const Cells& cells,
+              const CellRange& range) {
+        surface = target.surface();
+        origin_y = y;
+        origin_x = x;
+        lines.update(range.cols, style);
+        line(target, origin_y, lines.top);
+        if (in_parallel<Cells>(range)) {
+            values_in_parallel(target, cells, range);
+        } else {
+            for (int r = 0; r < range.rows; ++r) {
+                if (r != 0) {
+                    line(target, cell_y(r) - 1, lines.middle);
+                }
+                values(target, cells, range, r);
             }
-            Color scoped(cell.color_code);
-            printline(cell.content, style.cell_width, Aligned::center);
         }
-        addwch(right);
-        end_line();
+        line(target, cell_y(range.rows) - 1, lines.bottom);
+        target.move(origin_y + height_in_lines(range.rows), origin_x);
+        if (redraw == Redraw::incremental) {
+            remember(target, cells, range);
+        }
     }
-    void sep_row(int n, auto left, auto plain, auto intersection, auto right) {
-        std::vector<Cell> sep(n, Cell(std::wstring(style.cell_width, plain)));
-        value_row(sep, left, intersection, right);
+    // Keeps what is on the screen for the next incremental print.
+    template <class Target, class Cells>
+    void remember(const Target& target, const Cells& cells,
+                  const CellRange& range) {
+        previous.resize(range.rows, range.cols);
+        invalidated.clear();
+        for (int r = 0; r < range.rows; ++r) {
+            for (int c = 0; c < range.cols; ++c) {
+                previous.set(r, c, at(cells, range, r, c));
+            }
+        }
+        previous_lines = target.lines();
+        previous_cols = target.cols();
     }
-
-    void top_row(int n) {
-        const auto& box = style.box_style;
-        sep_row(n, box.corners.top_left, box.borders.horizontal,
-                box.intersections.top, box.corners.top_right);
+    static int n_cols(const std::vector<std::vector<Cell>>& data) {
+        return data.empty() ? 0 : data[0].size();
     }
-    void bottom_row(int n) {
-        const auto& box = style.box_style;
-        sep_row(n, box.corners.bottom_left, box.borders.horizontal,
-                box.intersections.bottom, box.corners.bottom_right);
+    // Composes the content line of row r in characters and returns its
+    // length. Wide glyphs take two columns but a single cchar_t, so the line
+    // can be shorter than the buffer.
+    // switches counts the changes of attributes along the line. When there
+    // are padding lines, padding is a copy of the padding line that the
+    // cells color in the same pass, so that each cell is read once.
+    template <class Cells>
+    std::size_t value_row(const Cells& cells, const CellRange& range, int r,
+                          std::vector<cchar_t>& characters,
+                          std::vector<cchar_t>* padding,
+                          [[maybe_unused]] long& switches) const {
+        const auto vertical = wide_char(style.box_style.borders.vertical);
+        characters.resize(lines.padding.size());
+        auto out = characters.begin();
+        AttributeState attributes;
+        *out++ = vertical;
+        for (int c = 0; c < range.cols; ++c) {
+            if (c != 0) {
+                *out++ = vertical;
+            }
+            const auto cell = at(cells, range, r, c);
+            [[maybe_unused]] const auto switched =
+                attributes.update(cell.color_code);
+            CURSED_STATS(switches += switched);
+            if (padding) {
+                lines.color_padding(*padding, c, attributes);
+            }
+            out = centered_cell(cell, attributes, out);
+        }
+        *out++ = vertical;
+        return out - characters.begin();
+    }
+    template <class Target>
+    void line(Target& target, int y, const std::vector<cchar_t>& characters) {
+        put(target, y, origin_x, characters.data(), characters.size());
     }
-    void middle_row(int n) {
-        const auto& box = style.box_style;
-        sep_row(n, box.intersections.left, box.borders.horizontal,
-                box.intersections.center, box.intersections.right);
+    // Centers the content of a cell using its cached display width. Contents
+    // wider than a cell are cut so that they don't overwrite the borders.
+    template <class Out>
+    Out centered_cell(CellView cell, const AttributeState& attributes,
+                      Out out) const {
+        const int width = style.cell_width;
+        auto content_width =
+            cell.width < 0 ? display_width(cell.content) : cell.width;
+        if (content_width > width) {
+            content_width = 0;
+            std::size_t length = 0;
+            for (; length < cell.content.length(); ++length) {
+                const auto glyph_width =
+                    std::max(0, wcwidth(cell.content[length]));
+                if (content_width + glyph_width > width) {
+                    break;
+                }
+                content_width += glyph_width;
+            }
+            cell.content = cell.content.substr(0, length);
+        }
+        const auto offset = std::max(0, width - content_width) / 2;
+        out = std::fill_n(out, offset, attributes.blank());
+        out = glyphs(cell.content, attributes, out);
+        return std::fill_n(out, std::max(0, width - (content_width + offset)),
+                           attributes.blank());
     }
-    void values(const std::vector<Cell>& row) {
-        const auto& box = style.box_style;
-        auto padding_row = row;
-        for (auto& cell : padding_row) {
-            cell.content = std::wstring(style.cell_width, L' ');
+    // Writes one cchar_t per glyph that takes columns. The characters that
+    // take none are combined with the glyph before them, as many as a
+    // cchar_t holds, so that the lines keep one cchar_t per column; those
+    // with no glyph before them, and the non printable ones, are dropped.
+    template <class Out>
+    static Out glyphs(std::wstring_view content,
+                      const AttributeState& attributes, Out out) {
+        auto combined = CCHARW_MAX;
+        for (const auto character : content) {
+            if ((character >= 0x20 && character < 0x7f) ||
+                wcwidth(character) > 0) {
+                *out++ = attributes.glyph(character);
+                combined = 1;
+            } else if (combined < CCHARW_MAX && wcwidth(character) == 0) {
+                (out - 1)->chars[combined++] = character;
+            }
         }
+        return out;
+    }
+
+    template <class Target, class Cells>
+    void values(Target& target, const Cells& cells, const CellRange& range,
+                int r) {
+        long switches = 0;
+        const auto length =
+            value_row(cells, range, r, row_line,
+                      style.cell_height > 1 ? &lines.padding : nullptr,
+                      switches);
+        CURSED_STATS(statistics.attribute_switches += switches);
+        row(target, r, lines.padding, row_line.data(), length);
+    }
+    // Writes the lines inside the cells of row r: the value line between the
+    // padding lines.
+    template <class Target>
+    void row(Target& target, int r, const std::vector<cchar_t>& padding,
+             const cchar_t* value, std::size_t length) {
         const auto line_height = 1;
-        const auto top_pad = (style.cell_height - line_height) / 2;
+        const auto top_pad = top_padding();
+        const auto bottom_pad = style.cell_height - (top_pad + line_height);
+        const auto y = cell_y(r);
         for (auto i = 0; i < top_pad; ++i) {
-            value_row(padding_row, box.borders.vertical, box.borders.vertical,
-                      box.borders.vertical);
+            line(target, y + i, padding);
         }
-        value_row(row, box.borders.vertical, box.borders.vertical,
-                  box.borders.vertical);
-        auto bottom_pad = style.cell_height - (top_pad + line_height);
+        put(target, y + top_pad, origin_x, value, length);
         for (auto i = 0; i < bottom_pad; ++i) {
-            value_row(padding_row, box.borders.vertical, box.borders.vertical,
-                      box.borders.vertical);
+            line(target, y + top_pad + line_height + i, padding);
+        }
+    }
+    // A row formatted by a worker, waiting to be written.
+    struct FormattedRow {
+        std::vector<cchar_t> value;
+        std::size_t length = 0;
+        std::vector<cchar_t> padding;
+        long switches = 0;
+    };
+    // Formats batches of rows on the workers while the previous batch is
+    // written, so that the target is only ever touched by this thread.
+    template <class Target, class Cells>
+    void values_in_parallel(Target& target, const Cells& cells,
+                            const CellRange& range) {
+        const auto batch = rows_per_worker * workers->size();
+        formatted.resize(2 * batch);
+        int first_formatted = 0;
+        auto format = [&](int i) {
+            const auto r = first_formatted + i;
+            auto& row = formatted[r % (2 * batch)];
+            if (style.cell_height > 1) {
+                row.padding = lines.padding;
+            }
+            row.switches = 0;
+            row.length =
+                value_row(cells, range, r, row.value,
+                          style.cell_height > 1 ? &row.padding : nullptr,
+                          row.switches);
+        };
+        workers->start(std::min(batch, range.rows), format);
+        for (int first = 0; first < range.rows; first += batch) {
+            workers->wait();
+            const auto last = std::min(first + batch, range.rows);
+            if (last < range.rows) {
+                first_formatted = last;
+                workers->start(std::min(batch, range.rows - last), format);
+            }
+            for (int r = first; r < last; ++r) {
+                if (r != 0) {
+                    line(target, cell_y(r) - 1, lines.middle);
+                }
+                const auto& row = formatted[r % (2 * batch)];
+                this->row(target, r, row.padding, row.value.data(),
+                          row.length);
+                CURSED_STATS(statistics.attribute_switches += row.switches);
+            }
         }
     }
     void sep_col() { addwch(style.box_style.borders.vertical); }
 
+    int top_padding() const {
+        const auto line_height = 1;
+        return (style.cell_height - line_height) / 2;
+    }
+    // Screen coordinates of the top left character inside a cell.
+    int cell_y(int r) const { return origin_y + placed.cell_y(r); }
+    int cell_x(int c) const { return origin_x + placed.cell_x(c); }
+    int height_in_lines(int rows) const {
+        return geometry(rows, 0).height();
+    }
+    // Whether the cell at (r, c) of the part of the matrix that is shown is
+    // inside of it.
+    bool is_shown(int r, int c) const {
+        return r >= 0 && r < shown.rows && c >= 0 && c < shown.cols;
+    }
+    template <class Target>
+    bool can_update(const Target& target, const CellRange& range) const {
+        return !resized(target) && range.rows == previous.rows() &&
+               range.cols == previous.cols();
+    }
+    template <class Target>
+    bool resized(const Target& target) const {
+        return target.lines() != previous_lines ||
+               target.cols() != previous_cols;
+    }
+    // Adapts the previous frame to a resized target. The cells that stay
+    // visible are only rewritten when they changed; the borders that moved
+    // and the cells that became visible are drawn. What was cut off is
+    // outside of the target, so there is nothing to erase.
+    template <class Target, class Cells>
+    void reflow(Target& target, const Cells& cells, const CellRange& range) {
+        redraw_invalidated(target, cells, range);
+        // Cells that the previous target cut are drawn again.
+        const auto whole = [](int available, int cell_size) {
+            return std::max(0, available / (cell_size + 1));
+        };
+        const auto kept_rows =
+            std::min({previous.rows(), range.rows,
+                      whole(previous_lines - origin_y, style.cell_height)});
+        const auto kept_cols =
+            std::min({previous.cols(), range.cols,
+                      whole(previous_cols - origin_x, style.cell_width)});
+        lines.update(range.cols, style);
+        // Horizontal lines span all the columns, so they all change with the
+        // width. Otherwise the bottom border moved, and the lines from the
+        // last row kept down are now separators.
+        const auto first_line =
+            range.cols != previous.cols() || target.cols() != previous_cols
+                ? 0
+                : kept_rows;
+        for (int k = first_line; k <= range.rows; ++k) {
+            line(target, k == 0 ? origin_y : cell_y(k) - 1,
+                 k == 0                ? lines.top
+                 : k == range.rows     ? lines.bottom
+                                       : lines.middle);
+        }
+        const auto vertical = wide_char(style.box_style.borders.vertical);
+        for (int r = 0; r < kept_rows; ++r) {
+            // The separators left of the new columns and the right border,
+            // which the previous target may have cut too.
+            for (int c = kept_cols; c <= range.cols; ++c) {
+                for (auto i = 0; i < style.cell_height; ++i) {
+                    put(target, cell_y(r) + i, cell_x(c) - 1, &vertical, 1);
+                }
+            }
+            for (int c = 0; c < range.cols; ++c) {
+                const auto cell = at(cells, range, r, c);
+                if (c >= kept_cols || cell != previous(r, c)) {
+                    this->cell(target, r, c, cell);
+                } else {
+                    CURSED_STATS(++statistics.cells_skipped);
+                }
+            }
+        }
+        for (int r = kept_rows; r < range.rows; ++r) {
+            values(target, cells, range, r);
+        }
+        CURSED_STATS(statistics.cells_drawn +=
+                     static_cast<long>(range.rows - kept_rows) * range.cols);
+        target.move(origin_y + height_in_lines(range.rows), origin_x);
+        remember(target, cells, range);
+    }
+    // Rewrites the cells that differ from the ones on the screen, which also
+    // covers scrolling the range.
+    template <class Target, class Cells>
+    void update(Target& target, const Cells& cells, const CellRange& range) {
+        redraw_invalidated(target, cells, range);
+        for (int r = 0; r < range.rows; ++r) {
+            for (int c = 0; c < range.cols; ++c) {
+                const auto cell = at(cells, range, r, c);
+                if (cell != previous(r, c)) {
+                    this->cell(target, r, c, cell);
+                    previous.set(r, c, cell);
+                } else {
+                    CURSED_STATS(++statistics.cells_skipped);
+                }
+            }
+        }
+        // Leave the cursor where a full print would have left it.
+        target.move(origin_y + height_in_lines(range.rows), origin_x);
+    }
+    // Rewrites the cells given to invalidate_cell, which then match previous
+    // as any cell just drawn.
+    template <class Target, class Cells>
+    void redraw_invalidated(Target& target, const Cells& cells,
+                            const CellRange& range) {
+        for (const auto [r, c] : invalidated) {
+            if (r < std::min(range.rows, previous.rows()) &&
+                c < std::min(range.cols, previous.cols())) {
+                const auto cell = at(cells, range, r, c);
+                this->cell(target, r, c, cell);
+                previous.set(r, c, cell);
+            }
+        }
+        invalidated.clear();
+    }
+    // Rewrites the inside of one cell, padding lines included.
+    template <class Target>
+    void cell(Target& target, int r, int c, CellView cell) {
+        const auto y = cell_y(r);
+        const auto x = cell_x(c);
+        const auto top_pad = top_padding();
+        AttributeState attributes;
+        attributes.update(cell.color_code);
+        CURSED_STATS(++statistics.cells_drawn;
+                     ++statistics.attribute_switches);
+        row_line.resize(style.cell_width);
+        for (auto i = 0; i < style.cell_height; ++i) {
+            const auto end =
+                centered_cell(i == top_pad ? cell : CellView{{}, 0, 0},
+                              attributes, row_line.begin());
+            put(target, y + i, x, row_line.data(), end - row_line.begin());
+        }
+    }
+
    private:
     const MatrixStyle style;
+    const Redraw redraw;
+    LineCache lines;
+    CellGrid owned;
+    CellGrid staging;
+    CellGrid previous;
+    // Cells of previous that no longer are on the screen.
+    std::vector<CellPosition> invalidated;
+    std::vector<cchar_t> row_line;
+    // Matrices with fewer cells are formatted by the calling thread alone.
+    static constexpr int parallel_cells = 4096;
+    static constexpr int rows_per_worker = 4;
+    std::unique_ptr<WorkerPool> workers;
+    std::vector<FormattedRow> formatted;
+#ifdef CURSED_ENABLE_STATS
+    RenderStats statistics;
+#endif
+    // What the previous frame was drawn on, and the part of the matrix it
+    // shows.
+    const void* surface = nullptr;
+    CellRange shown;
+    MatrixGeometry placed;
+    // Rows appended since the streamed matrix was started.
+    long streamed_rows = 0;
+    int origin_y = 0;
+    int origin_x = 0;
+    int previous_lines = 0;
+    int previous_cols = 0;
+};
+
+// Matrices shown side by side on the screen, each in a window of its own
+// that only its changes touch. A frame draws the panels whose data changed
+// since the previous one and copies them to the terminal with a single
+// doupdate, so a change in one panel costs nothing to the others.
+class PanelLayout {
+   public:
+    // gap is the number of blank characters between two panels.
+    explicit PanelLayout(Environment& environment_, int gap_ = 1)
+        : environment(environment_), gap(gap_) {}
+    PanelLayout(const PanelLayout&) = delete;
+    PanelLayout& operator=(const PanelLayout&) = delete;
+    // Adds a panel for a rows by cols matrix right of the previous one, or
+    // below the previous row of panels when the screen is too narrow, and
+    // returns its index. The window of the panel is cut to the screen, and a
+    // panel that starts outside of it is never drawn.
+    std::size_t add(const MatrixStyle& style, int rows, int cols) {
+        const MatrixGeometry geometry(rows, cols, style);
+        const auto lines = geometry.height();
+        const auto width = geometry.width();
+        if (next_x > 0 && next_x + width > COLS) {
+            next_x = 0;
+            next_y += row_height + gap;
+            row_height = 0;
+        }
+        WINDOW* window = nullptr;
+        if (next_y < LINES && next_x < COLS) {
+            window = environment.window(std::min(lines, LINES - next_y),
+                                        std::min(width, COLS - next_x),
+                                        next_y, next_x);
+        }
+        next_x += width + gap;
+        row_height = std::max(row_height, lines);
+        panels.emplace_back(style, window);
+        return panels.size() - 1;
+    }
+    std::size_t size() const { return panels.size(); }
+    // The data of a panel, which the next frame draws if it changed.
+    void set_data(std::size_t panel, CellGrid&& grid) {
+        panels[panel].display.set_data(std::move(grid));
+        panels[panel].changed = true;
+    }
+    void swap_data(std::size_t panel, CellGrid& grid) {
+        panels[panel].display.swap_data(grid);
+        panels[panel].changed = true;
+    }
+    bool apply(std::size_t panel, const FrameDelta& delta) {
+        const auto applied = panels[panel].display.apply(delta);
+        panels[panel].changed |= applied;
+        return applied;
+    }
+    const CellGrid& data(std::size_t panel) const {
+        return panels[panel].display.data();
+    }
+    // Draws every panel again at the next frame, e.g. after the screen was
+    // cleared.
+    void invalidate() {
+        for (auto& panel : panels) {
+            panel.display.invalidate();
+            panel.changed = true;
+        }
+    }
+    // Draws the panels that changed, incrementally, and flushes the
+    // environment.
+    void render() {
+        for (auto& panel : panels) {
+            if (panel.changed && panel.window != nullptr &&
+                !panel.display.data().empty()) {
+                panel.display.print(panel.window, 0, 0);
+            }
+            panel.changed = false;
+        }
+        environment.flush();
+    }
+    // The display of a panel, e.g. for its statistics, and its window, which
+    // is null for a panel outside of the screen.
+    const MatrixDisplay& display(std::size_t panel) const {
+        return panels[panel].display;
+    }
+    WINDOW* window(std::size_t panel) const { return panels[panel].window; }
+
+   private:
+    struct Panel {
+        Panel(const MatrixStyle& style, WINDOW* window_)
+            : display(style, Redraw::incremental), window(window_) {}
+        MatrixDisplay display;
+        WINDOW* window;
+        bool changed = false;
+    };
+
+    Environment& environment;
+    const int gap;
+    // A deque keeps the displays given by display where they are.
+    std::deque<Panel> panels;
+    // Where the next panel goes, and the height of the row of panels it
+    // would join.
+    int next_y = 0;
+    int next_x = 0;
+    int row_height = 0;
 };
 }  // namespace ncurses